@@ -16,15 +16,58 @@
 using namespace std;
 using namespace XUSG;
 
+// Heap allocations of the process, counted for the CPU benchmark of the draw recording
+// in the builds with COUNT_HEAP_ALLOCS=1 only, as the replaced operators affect every run
+#if COUNT_HEAP_ALLOCS
+static volatile LONG64 g_numAllocs = 0;
+
+void* operator new(size_t size)
+{
+	InterlockedIncrement64(&g_numAllocs);
+	const auto p = malloc(size ? size : 1);
+	if (!p) throw bad_alloc();
+
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+#endif
+
 ComputeRaster::ComputeRaster(uint32_t width, uint32_t height, std::wstring name) :
 	DXFramework(width, height, name),
 	m_frameIndex(0),
 	m_deviceType(DEVICE_DISCRETE),
 	m_showFPS(true),
 	m_isPaused(false),
+	m_rasterMode(SoftGraphicsPipeline::RASTER_UNORDERED),
+	m_blendMode(SoftGraphicsPipeline::BLEND_OPAQUE),
+	m_occlusionCulling(true),
+	m_zPrepass(false),
+	m_gpuCulling(false),
+	m_meshletCulling(false),
+	m_shadingRate(SoftGraphicsPipeline::SHADING_RATE_1X1),
+	m_gpuTime(0.0f),
+	m_autotune(false),
+	m_tuneCandidate(0),
+	m_bestCandidate(0),
+	m_tuneFrame(0),
+	m_tuneTime(0.0),
+	m_bestTuneTime(DBL_MAX),
+	m_benchmark(false),
+	m_benchFrame(0),
+	m_benchTimes(),
+	m_cpuBench(false),
+	m_cpuBenchFrame(0),
+	m_cpuBenchTime(0),
+	m_cpuBenchAllocs(0),
 	m_tracking(false),
 	m_meshFileName("Assets/bunny.obj"),
 	m_meshPosScale(0.0f, 0.0f, 0.0f, 1.0f),
+	m_numInstances(1),
+	m_features(SoftGraphicsPipeline::DefaultFeatures),
 	m_screenShot(0)
 {
 #if defined (_DEBUG)
@@ -158,7 +201,26 @@ void ComputeRaster::LoadAssets()
 	vector<Resource::uptr> uploaders(0);
 	XUSG_X_RETURN(m_renderer, make_unique<Renderer>(), ThrowIfFailed(E_FAIL));
 	XUSG_N_RETURN(m_renderer->Init(pCommandList, m_width, m_height, uploaders,
-		m_meshFileName.c_str(), m_meshPosScale), ThrowIfFailed(E_FAIL));
+		m_meshFileName.c_str(), m_meshPosScale, m_numInstances), ThrowIfFailed(E_FAIL));
+	m_renderer->SetOcclusionCulling(m_occlusionCulling);
+	m_renderer->SetFeatures(static_cast<uint8_t>(m_features));
+
+	// Create the timestamp queries for the GPU time of the whole frame rendering
+	{
+		D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+		queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		queryHeapDesc.Count = 2 * SoftGraphicsPipeline::FrameCount;
+		const auto pDevice = static_cast<ID3D12Device*>(m_device->GetHandle());
+		ThrowIfFailed(pDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&m_queryHeap)));
+
+		m_timestamps = Buffer::MakeUnique();
+		XUSG_N_RETURN(m_timestamps->Create(m_device.get(), sizeof(uint64_t[2]) * SoftGraphicsPipeline::FrameCount,
+			ResourceFlag::DENY_SHADER_RESOURCE, MemoryType::READBACK, 0, nullptr, 0, nullptr,
+			MemoryFlag::NONE, L"Timestamps"), ThrowIfFailed(E_FAIL));
+
+		const auto pCommandQueue = static_cast<ID3D12CommandQueue*>(m_commandQueue->GetHandle());
+		ThrowIfFailed(pCommandQueue->GetTimestampFrequency(&m_timestampFreq));
+	}
 
 	// Close the command list and execute it to begin the initial GPU setup.
 	XUSG_N_RETURN(pCommandList->Close(), ThrowIfFailed(E_FAIL));
@@ -182,9 +244,13 @@ void ComputeRaster::LoadAssets()
 		WaitForGpu();
 	}
 
-	// Projection
+	// Tile and bin sizes, either tuned previously or to be tuned from the first candidate
+	if (m_autotune) SetTileSizes(m_tuneCandidate);
+	else LoadTileSizes();
+
+	// Projection, reverse-Z to spend the float precision on the distance
 	const auto aspectRatio = m_width / static_cast<float>(m_height);
-	const auto proj = XMMatrixPerspectiveFovLH(g_FOVAngleY, aspectRatio, g_zNear, g_zFar);
+	const auto proj = XMMatrixPerspectiveFovLH(g_FOVAngleY, aspectRatio, g_zFar, g_zNear);
 	XMStoreFloat4x4(&m_proj, proj);
 
 	// View initialization
@@ -249,6 +315,36 @@ void ComputeRaster::OnKeyUp(uint8_t key)
 	case VK_F1:
 		m_showFPS = !m_showFPS;
 		break;
+	case VK_F2:
+		m_rasterMode = static_cast<SoftGraphicsPipeline::RasterMode>((m_rasterMode + 1) % 2);
+		m_renderer->SetRasterMode(m_rasterMode);
+		break;
+	case VK_F3:
+		m_blendMode = static_cast<SoftGraphicsPipeline::BlendMode>((m_blendMode + 1) % 4);
+		m_renderer->SetBlendMode(m_blendMode);
+		break;
+	case VK_F4:
+		m_occlusionCulling = !m_occlusionCulling;
+		m_renderer->SetOcclusionCulling(m_occlusionCulling);
+		break;
+	case VK_F5:
+		m_zPrepass = !m_zPrepass;
+		m_renderer->SetZPrepass(m_zPrepass);
+		break;
+	case VK_F6:
+		m_gpuCulling = !m_gpuCulling;
+		m_renderer->SetGpuCulling(m_gpuCulling);
+		break;
+	case VK_F7:
+		m_meshletCulling = !m_meshletCulling;
+		m_renderer->SetMeshletCulling(m_meshletCulling);
+		break;
+	case VK_F8:
+		// The coarse rates need the VRS permutation of the pixel raster
+		m_shadingRate = static_cast<SoftGraphicsPipeline::ShadingRate>((m_shadingRate + 1) % 3);
+		m_renderer->SetShadingRate(m_shadingRate);
+		m_renderer->SetFeatures(static_cast<uint8_t>(m_shadingRate ? m_features | SoftGraphicsPipeline::FEATURE_VRS : m_features));
+		break;
 	case VK_F11:
 		m_screenShot = 1;
 		break;
@@ -348,6 +444,9 @@ void ComputeRaster::ParseCommandLineArgs(wchar_t* argv[], int argc)
 	{
 		if (isArgMatched(i, L"warp")) m_deviceType = DEVICE_WARP;
 		else if (isArgMatched(i, L"uma")) m_deviceType = DEVICE_UMA;
+		else if (isArgMatched(i, L"autotune")) m_autotune = true;
+		else if (isArgMatched(i, L"benchprepass")) m_benchmark = true;
+		else if (isArgMatched(i, L"cpubench")) m_cpuBench = true;
 		else if (isArgMatched(i, L"mesh"))
 		{
 			if (hasNextArgValue(i))
@@ -361,6 +460,14 @@ void ComputeRaster::ParseCommandLineArgs(wchar_t* argv[], int argc)
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.z);
 			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%f", &m_meshPosScale.w);
 		}
+		else if (isArgMatched(i, L"instances"))
+		{
+			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%u", &m_numInstances);
+		}
+		else if (isArgMatched(i, L"features"))
+		{
+			if (hasNextArgValue(i)) i += swscanf_s(argv[i + 1], L"%x", &m_features);
+		}
 	}
 }
 
@@ -379,9 +486,15 @@ void ComputeRaster::PopulateCommandList()
 	XUSG_N_RETURN(pCommandList->Reset(pCommandAllocator, nullptr), ThrowIfFailed(E_FAIL));
 
 	// Record commands.
-	m_renderer->Render(pCommandList, m_frameIndex);
-
-	// Copy to back buffer.
+	const auto queryIdx = 2 * m_frameIndex;
+	pCommandList->EndQuery(m_queryHeap.get(), QueryType::TIMESTAMP, queryIdx);
+	if (m_cpuBench) CpuBenchmark(pCommandList);
+	else XUSG_N_RETURN(m_renderer->Render(pCommandList, m_frameIndex), ThrowIfFailed(E_FAIL));
+	pCommandList->EndQuery(m_queryHeap.get(), QueryType::TIMESTAMP, queryIdx + 1);
+	pCommandList->ResolveQueryData(m_queryHeap.get(), QueryType::TIMESTAMP, queryIdx, 2,
+		m_timestamps.get(), sizeof(uint64_t) * queryIdx);
+
+	// Copy to back buffer, as a whole, since the flip-discard back buffers lose their contents after presents.
 	const auto pRenderTarget = m_renderTargets[m_frameIndex].get();
 	{
 		const auto pColorTarget = m_renderer->GetColorTarget();
@@ -445,6 +558,20 @@ void ComputeRaster::MoveToNextFrame()
 	// Set the fence value for the next frame.
 	m_fenceValues[m_frameIndex] = currentFenceValue + 1;
 
+	// GPU timing of the completed frame, smoothed over frames
+	{
+		const Range range(sizeof(uint64_t[2]) * m_frameIndex, sizeof(uint64_t[2]) * (m_frameIndex + 1));
+		const auto pTimestamps = static_cast<const uint64_t*>(m_timestamps->Map(&range)) + 2 * m_frameIndex;
+		if (pTimestamps[1] > pTimestamps[0])
+		{
+			const auto gpuTime = static_cast<float>(1000.0 * (pTimestamps[1] - pTimestamps[0]) / m_timestampFreq);
+			m_gpuTime = m_gpuTime > 0.0f ? m_gpuTime * 0.95f + gpuTime * 0.05f : gpuTime;
+			if (m_autotune) Autotune(gpuTime);
+			else if (m_benchmark) Benchmark(gpuTime);
+		}
+		m_timestamps->Unmap();
+	}
+
 	// Screen-shot helper
 	if (m_screenShot)
 	{
@@ -505,6 +632,22 @@ double ComputeRaster::CalculateFrameStats(float* pTimeStep)
 		if (m_showFPS) windowText << setprecision(2) << fixed << fps;
 		else windowText << L"[F1]";
 
+		static const wchar_t* const rasterModes[] = { L"unordered", L"tile-ordered" };
+		static const wchar_t* const blendModes[] = { L"opaque", L"alpha", L"additive", L"premultiplied" };
+		static const wchar_t* const shadingRates[] = { L"1x1", L"2x2", L"4x4" };
+		windowText << L"    GPU: ";
+		if (m_showFPS) windowText << setprecision(3) << fixed << m_gpuTime << L" ms";
+		windowText << L"    [F2] " << rasterModes[m_blendMode ? 1 : m_rasterMode];
+		windowText << L"    [F3] blend " << blendModes[m_blendMode];
+		windowText << L"    [F4] occlusion culling " << (m_occlusionCulling ? L"on" : L"off");
+		windowText << L"    [F5] Z-prepass " << (m_zPrepass ? L"on" : L"off");
+		windowText << L"    [F6] GPU culling " << (m_gpuCulling ? L"on" : L"off");
+		windowText << L"    [F7] " << (m_meshletCulling ? L"meshlets" : L"instances");
+		windowText << L"    [F8] shading " << shadingRates[m_shadingRate];
+
+		if (m_autotune) windowText << L"    autotuning...";
+		else if (m_benchmark) windowText << L"    benchmarking...";
+
 		windowText << L"    [F11] screen shot";
 
 		SetCustomWindowText(windowText.str().c_str());
@@ -514,3 +657,138 @@ double ComputeRaster::CalculateFrameStats(float* pTimeStep)
 
 	return totalTime;
 }
+
+// Tile and bin size candidates, tile sizes of 4, 8, and 16 pixels by bins of 4, 8, and 16 tiles
+static const uint8_t g_numTuneCandidates = 9;
+static const uint32_t g_tuneWarmUpFrames = 8;
+static const uint32_t g_tuneSampleFrames = 32;
+static const char* const g_tuneFileName = "ComputeRaster.tune";
+
+// Render each candidate for a number of frames, and keep the fastest one.
+void ComputeRaster::Autotune(float gpuTime)
+{
+	// Skip the frames in flight with the previous candidate
+	if (m_tuneFrame++ >= g_tuneWarmUpFrames) m_tuneTime += gpuTime;
+	if (m_tuneFrame < g_tuneWarmUpFrames + g_tuneSampleFrames) return;
+
+	const auto tuneTime = m_tuneTime / g_tuneSampleFrames;
+	if (tuneTime < m_bestTuneTime)
+	{
+		m_bestTuneTime = tuneTime;
+		m_bestCandidate = m_tuneCandidate;
+	}
+	m_tuneFrame = 0;
+	m_tuneTime = 0.0;
+
+	if (++m_tuneCandidate < g_numTuneCandidates) SetTileSizes(m_tuneCandidate);
+	else
+	{
+		SetTileSizes(m_bestCandidate);
+		SaveTileSizes();
+		m_autotune = false;
+	}
+}
+
+void ComputeRaster::SetTileSizes(uint8_t candidate)
+{
+	// The depth buffer is recreated
+	WaitForGpu();
+	XUSG_N_RETURN(m_renderer->SetTileSizes(m_device.get(), 2 + candidate / 3, 2 + candidate % 3), ThrowIfFailed(E_FAIL));
+}
+
+// The tuned tile and bin sizes are persisted per resolution and mesh.
+bool ComputeRaster::LoadTileSizes()
+{
+	ifstream fileIn(g_tuneFileName);
+	if (!fileIn) return false;
+
+	uint32_t width, height, candidate;
+	string meshFileName;
+	while (fileIn >> width >> height >> candidate && getline(fileIn >> ws, meshFileName))
+	{
+		if (width == m_width && height == m_height && meshFileName == m_meshFileName && candidate < g_numTuneCandidates)
+		{
+			SetTileSizes(static_cast<uint8_t>(candidate));
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ComputeRaster::SaveTileSizes() const
+{
+	// Keep the entries of the other resolutions and meshes
+	vector<string> lines;
+	{
+		ifstream fileIn(g_tuneFileName);
+		uint32_t width, height, candidate;
+		string meshFileName;
+		while (fileIn >> width >> height >> candidate && getline(fileIn >> ws, meshFileName))
+			if (width != m_width || height != m_height || meshFileName != m_meshFileName)
+				lines.emplace_back(to_string(width) + " " + to_string(height) + " " + to_string(candidate) + " " + meshFileName);
+	}
+
+	ofstream fileOut(g_tuneFileName);
+	for (const auto& line : lines) fileOut << line << endl;
+	fileOut << m_width << " " << m_height << " " << static_cast<uint32_t>(m_bestCandidate) << " " << m_meshFileName << endl;
+}
+
+static const char* const g_benchFileName = "ComputeRaster.bench";
+
+// Render the single pass and then the Z-prepass for a number of frames each, and log the average GPU times.
+void ComputeRaster::Benchmark(float gpuTime)
+{
+	// Skip the frames in flight with the previous mode
+	if (m_benchFrame++ >= g_tuneWarmUpFrames) m_benchTimes[m_zPrepass] += gpuTime;
+	if (m_benchFrame < g_tuneWarmUpFrames + g_tuneSampleFrames) return;
+
+	m_benchTimes[m_zPrepass] /= g_tuneSampleFrames;
+	m_benchFrame = 0;
+
+	m_zPrepass = !m_zPrepass;
+	m_renderer->SetZPrepass(m_zPrepass);
+
+	if (!m_zPrepass)
+	{
+		ofstream fileOut(g_benchFileName, ios::app);
+		fileOut << m_width << " " << m_height << " " << m_meshFileName << fixed << setprecision(3)
+			<< "    single pass: " << m_benchTimes[0] << " ms    Z-prepass: " << m_benchTimes[1] << " ms" << endl;
+		m_benchmark = false;
+	}
+}
+
+static const uint32_t g_cpuBenchDraws = 1000;
+static const uint32_t g_cpuBenchSampleFrames = 10;
+
+// Record many small draws per frame, and log the average CPU time and heap allocations per draw.
+void ComputeRaster::CpuBenchmark(CommandList* pCommandList)
+{
+	LARGE_INTEGER start, end, freq;
+#if COUNT_HEAP_ALLOCS
+	const auto numAllocs = g_numAllocs;
+#endif
+	QueryPerformanceCounter(&start);
+	XUSG_N_RETURN(m_renderer->RenderDraws(pCommandList, m_frameIndex, g_cpuBenchDraws), ThrowIfFailed(E_FAIL));
+	QueryPerformanceCounter(&end);
+
+	// Skip the warm-up frames, of which the recording grows the caches and the scratch arrays
+	if (m_cpuBenchFrame++ < SoftGraphicsPipeline::FrameCount) return;
+	QueryPerformanceFrequency(&freq);
+	m_cpuBenchTime += static_cast<double>(end.QuadPart - start.QuadPart) / freq.QuadPart;
+#if COUNT_HEAP_ALLOCS
+	m_cpuBenchAllocs += g_numAllocs - numAllocs;
+#endif
+	if (m_cpuBenchFrame < SoftGraphicsPipeline::FrameCount + g_cpuBenchSampleFrames) return;
+
+	const auto numDraws = g_cpuBenchDraws * g_cpuBenchSampleFrames;
+	ofstream fileOut(g_benchFileName, ios::app);
+	fileOut << m_width << " " << m_height << " " << numDraws << " draws" << fixed << setprecision(3)
+		<< "    CPU: " << 1000000.0 * m_cpuBenchTime / numDraws << " us/draw";
+#if COUNT_HEAP_ALLOCS
+	fileOut << "    heap allocations: " << static_cast<double>(m_cpuBenchAllocs) / numDraws << " /draw";
+#endif
+	fileOut << endl;
+	m_cpuBench = false;
+}
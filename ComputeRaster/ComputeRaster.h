@@ -78,6 +78,15 @@ private:
 	bool		m_showFPS;
 	bool		m_isPaused;
 
+	// Raster modes
+	SoftGraphicsPipeline::RasterMode m_rasterMode;
+	SoftGraphicsPipeline::BlendMode m_blendMode;
+	bool m_occlusionCulling;
+	bool m_zPrepass;
+	bool m_gpuCulling;
+	bool m_meshletCulling;
+	SoftGraphicsPipeline::ShadingRate m_shadingRate;
+
 	// User camera interactions
 	bool m_tracking;
 	XMFLOAT2 m_mousePt;
@@ -85,6 +94,33 @@ private:
 	// User external settings
 	std::string m_meshFileName;
 	XMFLOAT4 m_meshPosScale;
+	uint32_t m_numInstances;
+	uint32_t m_features;
+
+	// GPU timing of the raster
+	XUSG::com_ptr<ID3D12QueryHeap> m_queryHeap;
+	XUSG::Buffer::uptr	m_timestamps;
+	uint64_t			m_timestampFreq;
+	float				m_gpuTime;
+
+	// Autotuning of the tile and bin sizes
+	bool		m_autotune;
+	uint8_t		m_tuneCandidate;
+	uint8_t		m_bestCandidate;
+	uint32_t	m_tuneFrame;
+	double		m_tuneTime;
+	double		m_bestTuneTime;
+
+	// Benchmark of the single pass against the Z-prepass
+	bool		m_benchmark;
+	uint32_t	m_benchFrame;
+	double		m_benchTimes[2];
+
+	// Benchmark of the CPU recording of many small draws
+	bool		m_cpuBench;
+	uint32_t	m_cpuBenchFrame;
+	double		m_cpuBenchTime;
+	uint64_t	m_cpuBenchAllocs;
 
 	// Screen-shot helpers and state
 	XUSG::Buffer::uptr	m_readBuffer;
@@ -100,4 +136,11 @@ private:
 	void SaveImage(char const* fileName, XUSG::Buffer* pImageBuffer,
 		uint32_t w, uint32_t h, uint32_t rowPitch, uint8_t comp = 3);
 	double CalculateFrameStats(float* fTimeStep = nullptr);
+
+	void Autotune(float gpuTime);
+	void SetTileSizes(uint8_t candidate);
+	bool LoadTileSizes();
+	void SaveTileSizes() const;
+	void Benchmark(float gpuTime);
+	void CpuBenchmark(XUSG::CommandList* pCommandList);
 };
@@ -9,7 +9,16 @@ using namespace std;
 using namespace DirectX;
 using namespace XUSG;
 
-Renderer::Renderer()
+Renderer::Renderer() :
+	m_boundMin(0.0f, 0.0f, 0.0f),
+	m_boundMax(0.0f, 0.0f, 0.0f),
+	m_screenRect(0, 0, LONG_MAX, LONG_MAX),
+	m_dirtyRect(0, 0, LONG_MAX, LONG_MAX),
+	m_numInstances(1),
+	m_numMeshletObjects(0),
+	m_zPrepass(false),
+	m_gpuCulling(false),
+	m_meshletCulling(false)
 {
 }
 
@@ -19,30 +28,41 @@ Renderer::~Renderer()
 
 bool Renderer::Init(CommandList* pCommandList, uint32_t width,
 	uint32_t height, vector<Resource::uptr>& uploaders, const char* fileName,
-	const XMFLOAT4& posScale)
+	const XMFLOAT4& posScale, uint32_t numInstances)
 {
 	const auto pDevice = pCommandList->GetDevice();
 	m_viewport.x = static_cast<float>(width);
 	m_viewport.y = static_cast<float>(height);
 	m_posScale = posScale;
+	m_numInstances = (max)(numInstances, 1u);
 
 	XUSG_X_RETURN(m_softGraphicsPipeline, make_unique<SoftGraphicsPipeline>(), false);
 	XUSG_N_RETURN(m_softGraphicsPipeline->Init(pCommandList, uploaders), false);
 
+	// Same as the pixel shader macros of the precompiled pixel raster, for the permutations
+	const SoftGraphicsPipeline::ShaderDefine shaderDefines[] =
+	{
+		{ "CR_ATTRIBUTE_BASE_TYPE0", "float" },
+		{ "CR_ATTRIBUTE_COMPONENT_COUNT0", "3" },
+		{ "CR_ATTRIBUTE0", "Nrm" },
+		{ "CR_TARGET_TYPE0", "float4" }
+	};
+	m_softGraphicsPipeline->SetShaderDefines(static_cast<uint32_t>(size(shaderDefines)), shaderDefines);
+
 	// Create Color target
 	m_colorTarget = Texture2D::MakeUnique();
 	XUSG_N_RETURN(m_colorTarget->Create(pDevice, width, height, Format::R8G8B8A8_UNORM, 1,
 		ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS), false);
 
 	// Create depth buffer
-	XUSG_N_RETURN(m_softGraphicsPipeline->CreateDepthBuffer(pDevice,
-		m_depth, width, height, Format::R32_UINT), false);
+	XUSG_N_RETURN(createDepthBuffer(pDevice), false);
 	
 	{
 		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
 		pipelineLayout->SetRange(0, DescriptorType::CBV, 1, 0, 0, DescriptorFlag::DATA_STATIC);
+		pipelineLayout->SetRange(1, DescriptorType::SRV, 1, 0, 0, DescriptorFlag::DATA_STATIC);
 		m_softGraphicsPipeline->SetAttribute(0, sizeof(uint32_t[4]), Format::R32G32B32A32_FLOAT, L"Normal");
-		XUSG_N_RETURN(m_softGraphicsPipeline->CreateVertexShaderLayout(pipelineLayout.get(), 1), false);
+		XUSG_N_RETURN(m_softGraphicsPipeline->CreateVertexShaderLayout(pipelineLayout.get(), 2, 0, -1, 0), false);
 	}
 
 	{
@@ -52,6 +72,9 @@ bool Renderer::Init(CommandList* pCommandList, uint32_t width,
 		XUSG_N_RETURN(m_softGraphicsPipeline->CreatePixelShaderLayout(pipelineLayout.get(), true, 1, 2, 1), false);
 	}
 
+	// Compile the pipelines with the assets, instead of on the first draw
+	XUSG_N_RETURN(m_softGraphicsPipeline->Compile(), false);
+
 	// Create constant buffers
 	const auto& frameCount = SoftGraphicsPipeline::FrameCount;
 	m_cbMatrices = ConstantBuffer::MakeUnique();
@@ -88,16 +111,23 @@ bool Renderer::Init(CommandList* pCommandList, uint32_t width,
 
 	m_vb = VertexBuffer::MakeUnique();
 	m_ib = IndexBuffer::MakeUnique();
+	vector<ObjLoader::Meshlet> meshlets;
 #if 1
 	// Load inputs
 	ObjLoader objLoader;
 	XUSG_N_RETURN(objLoader.Import(fileName, true, true), false);
 
+	const auto& aabb = objLoader.GetAABB();
+	const XMFLOAT3 extent(aabb.Max.x - aabb.Min.x, aabb.Max.y - aabb.Min.y, aabb.Max.z - aabb.Min.z);
 	m_numIndices = objLoader.GetNumIndices();
 	XUSG_N_RETURN(m_softGraphicsPipeline->CreateVertexBuffer(pCommandList, *m_vb, uploaders,
 		objLoader.GetVertices(), objLoader.GetNumVertices(), objLoader.GetVertexStride()), false);
 	XUSG_N_RETURN(m_softGraphicsPipeline->CreateIndexBuffer(pCommandList, *m_ib,
 		uploaders, objLoader.GetIndices(), m_numIndices, Format::R32_UINT), false);
+
+	// The meshlets keep the index order, so they are the ranges of the same index buffer
+	objLoader.BuildMeshlets();
+	meshlets.assign(objLoader.GetMeshlets(), objLoader.GetMeshlets() + objLoader.GetNumMeshlets());
 #else
 	const float vbData[] =
 	{
@@ -112,11 +142,92 @@ bool Renderer::Init(CommandList* pCommandList, uint32_t width,
 		uploaders, vbData, 3, sizeof(float[6])), false);
 
 	const uint16_t ibData[] = { 0, 1, 2 };
+	const struct { XMFLOAT3 Min, Max; } aabb = { XMFLOAT3(-5.0f, -1.0f, 0.0f), XMFLOAT3(5.0f, 9.0f, 0.0f) };
+	const XMFLOAT3 extent(10.0f, 10.0f, 0.0f);
 	m_numIndices = 3;
 	XUSG_N_RETURN(m_softGraphicsPipeline->CreateIndexBuffer(commandList, m_ib,
 		uploaders, ibData, m_numIndices, Format::R16_UINT), false);
 #endif
 
+	// Instances in a grid on the XZ plane, centered at the mesh position
+	{
+		const auto numColumns = static_cast<uint32_t>(ceil(sqrt(static_cast<float>(m_numInstances))));
+		const auto numRows = XUSG_DIV_UP(m_numInstances, numColumns);
+		vector<XMFLOAT3> offsets(m_numInstances);
+		for (auto i = 0u; i < m_numInstances; ++i)
+		{
+			offsets[i].x = (static_cast<float>(i % numColumns) - (numColumns - 1) * 0.5f) * extent.x * 1.2f;
+			offsets[i].y = 0.0f;
+			offsets[i].z = (static_cast<float>(i / numColumns) - (numRows - 1) * 0.5f) * extent.z * 1.2f;
+		}
+
+		m_instanceOffsets = StructuredBuffer::MakeUnique();
+		XUSG_N_RETURN(m_instanceOffsets->Create(pDevice, m_numInstances, sizeof(XMFLOAT3), ResourceFlag::NONE,
+			MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"InstanceOffsets"), false);
+		uploaders.emplace_back(Resource::MakeUnique());
+		XUSG_N_RETURN(m_instanceOffsets->Upload(pCommandList, uploaders.back().get(),
+			offsets.data(), sizeof(XMFLOAT3) * m_numInstances), false);
+
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_instanceOffsets->GetSRV());
+		m_srvTable = descriptorTable->GetCbvSrvUavTable(m_softGraphicsPipeline->GetDescriptorTableLib());
+
+		// Each instance is an object for the GPU culling, bounded in the object space
+		vector<SoftGraphicsPipeline::DrawObject> objects(m_numInstances);
+		for (auto i = 0u; i < m_numInstances; ++i)
+		{
+			auto& object = objects[i];
+			object.Args = { m_numIndices, 1, 0, 0, i };
+			object.ConeAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			object.ConeCutoff = 1.0f;
+			object.BoundMin = XMFLOAT3(aabb.Min.x + offsets[i].x, aabb.Min.y + offsets[i].y, aabb.Min.z + offsets[i].z);
+			object.BoundMax = XMFLOAT3(aabb.Max.x + offsets[i].x, aabb.Max.y + offsets[i].y, aabb.Max.z + offsets[i].z);
+			if (i == 0)
+			{
+				m_boundMin = object.BoundMin;
+				m_boundMax = object.BoundMax;
+			}
+			XMStoreFloat3(&m_boundMin, XMVectorMin(XMLoadFloat3(&object.BoundMin), XMLoadFloat3(&m_boundMin)));
+			XMStoreFloat3(&m_boundMax, XMVectorMax(XMLoadFloat3(&object.BoundMax), XMLoadFloat3(&m_boundMax)));
+		}
+
+		m_drawObjects = StructuredBuffer::MakeUnique();
+		XUSG_N_RETURN(m_drawObjects->Create(pDevice, m_numInstances, sizeof(SoftGraphicsPipeline::DrawObject),
+			ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"DrawObjects"), false);
+		uploaders.emplace_back(Resource::MakeUnique());
+		XUSG_N_RETURN(m_drawObjects->Upload(pCommandList, uploaders.back().get(), objects.data(),
+			sizeof(SoftGraphicsPipeline::DrawObject) * m_numInstances), false);
+
+		// Each meshlet of each instance is an object for the meshlet culling, which draws
+		// a single instance from its base instance
+		const auto numMeshlets = static_cast<uint32_t>(meshlets.size());
+		if (numMeshlets > 0 && numMeshlets * m_numInstances <= MAX_DRAW_OBJECTS)
+		{
+			m_numMeshletObjects = numMeshlets * m_numInstances;
+			vector<SoftGraphicsPipeline::DrawObject> meshletObjects(m_numMeshletObjects);
+			for (auto i = 0u; i < m_numMeshletObjects; ++i)
+			{
+				const auto& meshlet = meshlets[i % numMeshlets];
+				const auto instance = i / numMeshlets;
+				const auto& offset = offsets[instance];
+				const auto& bounds = meshlet.Bounds;
+				auto& object = meshletObjects[i];
+				object.Args = { meshlet.NumIndices, 1, meshlet.StartIndex, 0, instance };
+				object.BoundMin = XMFLOAT3(bounds.Min.x + offset.x, bounds.Min.y + offset.y, bounds.Min.z + offset.z);
+				object.BoundMax = XMFLOAT3(bounds.Max.x + offset.x, bounds.Max.y + offset.y, bounds.Max.z + offset.z);
+				object.ConeAxis = XMFLOAT3(meshlet.ConeAxis.x, meshlet.ConeAxis.y, meshlet.ConeAxis.z);
+				object.ConeCutoff = meshlet.ConeCutoff;
+			}
+
+			m_meshletObjects = StructuredBuffer::MakeUnique();
+			XUSG_N_RETURN(m_meshletObjects->Create(pDevice, m_numMeshletObjects, sizeof(SoftGraphicsPipeline::DrawObject),
+				ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"MeshletObjects"), false);
+			uploaders.emplace_back(Resource::MakeUnique());
+			XUSG_N_RETURN(m_meshletObjects->Upload(pCommandList, uploaders.back().get(), meshletObjects.data(),
+				sizeof(SoftGraphicsPipeline::DrawObject) * m_numMeshletObjects), false);
+		}
+	}
+
 	return true;
 }
 
@@ -133,7 +244,42 @@ void Renderer::UpdateFrame(uint8_t frameIndex, CXMMATRIX view,
 		const auto world = XMMatrixScaling(m_posScale.w, m_posScale.w, m_posScale.w) *
 			XMMatrixTranslation(m_posScale.x, m_posScale.y, m_posScale.z);
 		const auto worldInv = XMMatrixInverse(nullptr, world);
-		pCb->WorldViewProj = XMMatrixTranspose(world * view * proj);
+		const auto worldViewProj = world * view * proj;
+		pCb->WorldViewProj = XMMatrixTranspose(worldViewProj);
+		XMStoreFloat4x4(&m_worldViewProj, worldViewProj);
+
+		// Only the screen bounds of the instances in this and the last frames change, and the
+		// boxes crossing the near plane cover the full target
+		const auto width = static_cast<long>(m_viewport.x);
+		const auto height = static_cast<long>(m_viewport.y);
+		auto minPt = XMVectorReplicate(FLT_MAX), maxPt = XMVectorReplicate(-FLT_MAX);
+		auto isFull = false;
+		for (uint8_t i = 0; i < 8; ++i)
+		{
+			const auto corner = XMVectorSet(i & 1 ? m_boundMax.x : m_boundMin.x,
+				i & 2 ? m_boundMax.y : m_boundMin.y, i & 4 ? m_boundMax.z : m_boundMin.z, 1.0f);
+			const auto pos = XMVector4Transform(corner, worldViewProj);
+			isFull = isFull || XMVectorGetW(pos) <= 0.0f;
+			const auto ndc = XMVectorDivide(pos, XMVectorSplatW(pos));
+			minPt = XMVectorMin(ndc, minPt);
+			maxPt = XMVectorMax(ndc, maxPt);
+		}
+
+		RectRange screenRect(0, 0, width, height);
+		if (!isFull)
+		{
+			screenRect.Left = (max)(static_cast<long>(floor((XMVectorGetX(minPt) * 0.5f + 0.5f) * m_viewport.x)), 0l);
+			screenRect.Top = (max)(static_cast<long>(floor((0.5f - XMVectorGetY(maxPt) * 0.5f) * m_viewport.y)), 0l);
+			screenRect.Right = (min)(static_cast<long>(ceil((XMVectorGetX(maxPt) * 0.5f + 0.5f) * m_viewport.x)), width);
+			screenRect.Bottom = (min)(static_cast<long>(ceil((0.5f - XMVectorGetY(minPt) * 0.5f) * m_viewport.y)), height);
+			screenRect.Right = (max)(screenRect.Right, screenRect.Left);
+			screenRect.Bottom = (max)(screenRect.Bottom, screenRect.Top);
+		}
+		m_dirtyRect.Left = (min)(screenRect.Left, m_screenRect.Left);
+		m_dirtyRect.Top = (min)(screenRect.Top, m_screenRect.Top);
+		m_dirtyRect.Right = (min)((max)(screenRect.Right, m_screenRect.Right), width);
+		m_dirtyRect.Bottom = (min)((max)(screenRect.Bottom, m_screenRect.Bottom), height);
+		m_screenRect = screenRect;
 		pCb->Normal = worldInv;
 	}
 
@@ -153,24 +299,153 @@ void Renderer::UpdateFrame(uint8_t frameIndex, CXMMATRIX view,
 	}
 }
 
-void Renderer::Render(CommandList* pCommandList, uint8_t frameIndex)
+bool Renderer::Render(CommandList* pCommandList, uint8_t frameIndex)
 {
 	// Compute raster rendering
 	const float clearColor[] = { CLEAR_COLOR, 0.0f };
-	m_softGraphicsPipeline->SetDecriptorHeaps(pCommandList);
+	setStates(pCommandList, frameIndex);
+
+	// Z-prepass, so that the shading pass only shades the front-most fragments
+	if (m_zPrepass)
+	{
+		m_softGraphicsPipeline->SetRenderTargets(0, nullptr, &m_depth);
+		XUSG_N_RETURN(draw(pCommandList), false);
+		m_softGraphicsPipeline->SetDepthState(ComparisonFunc::EQUAL, false);
+	}
+
 	m_softGraphicsPipeline->SetRenderTargets(1, m_colorTarget.get(), &m_depth);
 	m_softGraphicsPipeline->ClearFloat(*m_colorTarget, clearColor);
-	m_softGraphicsPipeline->ClearDepth(1.0f);
-	m_softGraphicsPipeline->SetViewport(Viewport(0.0f, 0.0f, m_viewport.x, m_viewport.y));
-	m_softGraphicsPipeline->SetVertexBuffer(m_vb->GetSRV());
-	m_softGraphicsPipeline->SetIndexBuffer(m_ib->GetSRV());
-	m_softGraphicsPipeline->VSSetDescriptorTable(0, m_cbvTables[CBV_TABLE_MATRICES + frameIndex]);
 	m_softGraphicsPipeline->PSSetDescriptorTable(0, m_cbvTables[CBV_TABLE_LIGHTING + frameIndex]);
 	m_softGraphicsPipeline->PSSetDescriptorTable(1, m_cbvTables[CBV_TABLE_MATERIAL]);
-	m_softGraphicsPipeline->DrawIndexed(pCommandList, m_numIndices);
+
+	return draw(pCommandList);
+}
+
+bool Renderer::RenderDraws(CommandList* pCommandList, uint8_t frameIndex, uint32_t numDraws)
+{
+	// The first triangle per draw, so that the recording dominates the CPU time, where the
+	// targets are rebound per draw as the passes of a real scene would do, and the vertex
+	// reuse is off, so the same draws still process their vertices as distinct ones would
+	const float clearColor[] = { CLEAR_COLOR, 0.0f };
+	setStates(pCommandList, frameIndex);
+	m_softGraphicsPipeline->VSSetDataHash(0);
+	m_softGraphicsPipeline->SetRenderTargets(1, m_colorTarget.get(), &m_depth);
+	m_softGraphicsPipeline->ClearFloat(*m_colorTarget, clearColor);
+	m_softGraphicsPipeline->VSSetDescriptorTable(1, m_srvTable);
+	m_softGraphicsPipeline->PSSetDescriptorTable(0, m_cbvTables[CBV_TABLE_LIGHTING + frameIndex]);
+	m_softGraphicsPipeline->PSSetDescriptorTable(1, m_cbvTables[CBV_TABLE_MATERIAL]);
+
+	for (auto i = 0u; i < numDraws; ++i)
+	{
+		m_softGraphicsPipeline->SetRenderTargets(1, m_colorTarget.get(), &m_depth);
+		XUSG_N_RETURN(m_softGraphicsPipeline->DrawIndexed(pCommandList, 3), false);
+	}
+
+	return true;
+}
+
+void Renderer::SetRasterMode(SoftGraphicsPipeline::RasterMode mode)
+{
+	m_softGraphicsPipeline->SetRasterMode(mode);
+}
+
+void Renderer::SetBlendMode(SoftGraphicsPipeline::BlendMode mode)
+{
+	m_softGraphicsPipeline->SetBlendMode(mode);
+}
+
+void Renderer::SetOcclusionCulling(bool enable)
+{
+	m_softGraphicsPipeline->SetOcclusionCulling(enable);
+}
+
+void Renderer::SetZPrepass(bool enable)
+{
+	m_zPrepass = enable;
+}
+
+void Renderer::SetGpuCulling(bool enable)
+{
+	m_gpuCulling = enable;
+}
+
+void Renderer::SetMeshletCulling(bool enable)
+{
+	m_meshletCulling = enable;
+}
+
+bool Renderer::SetTileSizes(const Device* pDevice, uint8_t tileSizeLog, uint8_t tileToBinLog)
+{
+	m_softGraphicsPipeline->SetTileSizes(tileSizeLog, tileToBinLog);
+
+	// The tile and bin HiZ depend on the tile sizes
+	return createDepthBuffer(pDevice);
+}
+
+void Renderer::SetFeatures(uint8_t features)
+{
+	m_softGraphicsPipeline->SetFeatures(features);
+}
+
+void Renderer::SetShadingRate(SoftGraphicsPipeline::ShadingRate rate)
+{
+	m_softGraphicsPipeline->SetShadingRate(rate);
 }
 
 Texture2D* Renderer::GetColorTarget() const
 {
 	return m_colorTarget.get();
 }
+
+bool Renderer::createDepthBuffer(const Device* pDevice)
+{
+	const auto width = static_cast<uint32_t>(m_viewport.x);
+	const auto height = static_cast<uint32_t>(m_viewport.y);
+
+	// Add the bin levels until the coarsest bin grid is at most 32 bins wide,
+	// e.g., 512 -> 64 -> 8 pixels at 4K, so that the binning cost stays flat
+	const auto tileSizeLog = m_softGraphicsPipeline->GetTileSizeLog();
+	const auto tileToBinLog = m_softGraphicsPipeline->GetTileToBinLog();
+	uint8_t numBinLevels = 1;
+	while (numBinLevels < MAX_BIN_LEVELS && ((max)(width, height) >> (tileSizeLog + tileToBinLog * numBinLevels)) > 32)
+		++numBinLevels;
+	m_softGraphicsPipeline->SetBinLevels(USE_TRIPPLE_RASTER ? numBinLevels : 0);
+
+	// The new depth buffer is cleared as a whole in the next frame
+	m_screenRect = RectRange(0, 0, LONG_MAX, LONG_MAX);
+
+	return m_softGraphicsPipeline->CreateDepthBuffer(pDevice, m_depth, width, height, Format::R32_UINT);
+}
+
+void Renderer::setStates(CommandList* pCommandList, uint8_t frameIndex)
+{
+	m_softGraphicsPipeline->SetDecriptorHeaps(pCommandList);
+	m_softGraphicsPipeline->SetFrameIndex(frameIndex);
+	m_softGraphicsPipeline->SetDepthState(ComparisonFunc::GREATER_EQUAL);
+	m_softGraphicsPipeline->ClearDepth(0.0f);
+	m_softGraphicsPipeline->SetViewport(Viewport(0.0f, 0.0f, m_viewport.x, m_viewport.y));
+	m_softGraphicsPipeline->SetDirtyRects(1, &m_dirtyRect);
+	m_softGraphicsPipeline->SetVertexBuffer(m_vb->GetSRV());
+	m_softGraphicsPipeline->SetIndexBuffer(m_ib->GetSRV());
+	m_softGraphicsPipeline->VSSetDescriptorTable(0, m_cbvTables[CBV_TABLE_MATRICES + frameIndex]);
+
+	// The matrices change the vertex outputs only with the view, e.g., not on the paused frames with
+	// a static camera, as the world matrix and the instance offsets are static
+	m_softGraphicsPipeline->VSSetDataHash(SoftGraphicsPipeline::Hash(&m_worldViewProj, sizeof(m_worldViewProj)));
+}
+
+bool Renderer::draw(CommandList* pCommandList)
+{
+	// The instances, or their meshlets, are culled as the objects on the GPU, and the
+	// visible ones are drawn as the compacted draws
+	const auto isMeshlet = m_meshletCulling && m_numMeshletObjects > 0;
+	m_softGraphicsPipeline->VSSetDescriptorTable(1, m_srvTable);
+	if (m_gpuCulling && isMeshlet)
+		return m_softGraphicsPipeline->DrawIndexedIndirect(pCommandList, m_meshletObjects.get(), m_numMeshletObjects,
+			m_numIndices * m_numInstances, XMLoadFloat4x4(&m_worldViewProj));
+	if (m_gpuCulling && m_numInstances <= MAX_DRAW_OBJECTS)
+		return m_softGraphicsPipeline->DrawIndexedIndirect(pCommandList, m_drawObjects.get(), m_numInstances,
+			m_numIndices * m_numInstances, XMLoadFloat4x4(&m_worldViewProj));
+
+	return m_softGraphicsPipeline->DrawIndexedInstanced(pCommandList, m_numIndices, m_numInstances);
+}
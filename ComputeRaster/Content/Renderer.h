@@ -14,11 +14,21 @@ public:
 
 	bool Init(XUSG::CommandList* pCommandList, uint32_t width, uint32_t height,
 		std::vector<XUSG::Resource::uptr>& uploaders, const char* fileName,
-		const DirectX::XMFLOAT4& posScale);
+		const DirectX::XMFLOAT4& posScale, uint32_t numInstances = 1);
 
 	void UpdateFrame(uint8_t frameIndex, DirectX::CXMMATRIX view,
 		DirectX::CXMMATRIX proj, const DirectX::XMFLOAT3& eyePt, double time);
-	void Render(XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	bool Render(XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	bool RenderDraws(XUSG::CommandList* pCommandList, uint8_t frameIndex, uint32_t numDraws);	// Small draws for the CPU benchmark
+	void SetRasterMode(SoftGraphicsPipeline::RasterMode mode);
+	void SetBlendMode(SoftGraphicsPipeline::BlendMode mode);
+	void SetOcclusionCulling(bool enable);
+	void SetZPrepass(bool enable);	// Depth-only prepass, then shading with the equal test
+	void SetGpuCulling(bool enable);	// Each instance is culled as an object of an indirect draw
+	void SetMeshletCulling(bool enable);	// With the GPU culling, each meshlet of each instance is culled instead
+	bool SetTileSizes(const XUSG::Device* pDevice, uint8_t tileSizeLog, uint8_t tileToBinLog);
+	void SetFeatures(uint8_t features);	// SoftGraphicsPipeline::FeatureFlags of the shader permutations
+	void SetShadingRate(SoftGraphicsPipeline::ShadingRate rate);	// With FEATURE_VRS
 
 	XUSG::Texture2D* GetColorTarget() const;
 
@@ -32,9 +42,16 @@ protected:
 		NUM_CBV_TABLE
 	};
 
+	bool createDepthBuffer(const XUSG::Device* pDevice);
+	void setStates(XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	bool draw(XUSG::CommandList* pCommandList);
+
 	std::unique_ptr<SoftGraphicsPipeline> m_softGraphicsPipeline;
 	XUSG::VertexBuffer::uptr	m_vb;
 	XUSG::IndexBuffer::uptr		m_ib;
+	XUSG::StructuredBuffer::uptr m_instanceOffsets;
+	XUSG::StructuredBuffer::uptr m_drawObjects;
+	XUSG::StructuredBuffer::uptr m_meshletObjects;
 	XUSG::ConstantBuffer::uptr	m_cbMatrices;
 	XUSG::ConstantBuffer::uptr	m_cbLighting;
 	XUSG::ConstantBuffer::uptr	m_cbMaterial;
@@ -43,9 +60,22 @@ protected:
 	SoftGraphicsPipeline::DepthBuffer m_depth;
 
 	XUSG::DescriptorTable	m_cbvTables[NUM_CBV_TABLE];
+	XUSG::DescriptorTable	m_srvTable;
 
 	DirectX::XMFLOAT2		m_viewport;
 	DirectX::XMFLOAT4		m_posScale;
+	DirectX::XMFLOAT4X4		m_worldViewProj;
+	DirectX::XMFLOAT3		m_boundMin;	// Of all the instances in the object space
+	DirectX::XMFLOAT3		m_boundMax;
+
+	XUSG::RectRange			m_screenRect;	// Screen bounds of the instances in the last frame
+	XUSG::RectRange			m_dirtyRect;
 
 	uint32_t				m_numIndices;
+	uint32_t				m_numInstances;
+	uint32_t				m_numMeshletObjects;
+
+	bool					m_zPrepass;
+	bool					m_gpuCulling;
+	bool					m_meshletCulling;
 };
@@ -4,6 +4,7 @@
 
 #include "SharedConst.h"
 #include "Common.hlsli"
+#include "DepthPyramid.hlsli"
 
 //--------------------------------------------------------------------------------------
 // Structures
@@ -43,11 +44,32 @@ RWStructuredBuffer<TilePrim> g_rwTilePrimitives;
 
 globallycoherent
 RWTexture2D<uint> g_rwTileZ;
+
+// Bin levels from the finest to the coarsest (MAX_BIN_LEVELS)
+globallycoherent
+RWTexture2D<uint> g_rwBinZ0;
 globallycoherent
-RWTexture2D<uint> g_rwBinZ;
+RWTexture2D<uint> g_rwBinZ1;
+globallycoherent
+RWTexture2D<uint> g_rwBinZ2;
+
+RWStructuredBuffer<uint> g_rwBinPrimCount0;
+RWStructuredBuffer<uint> g_rwBinPrimCount1;
+RWStructuredBuffer<uint> g_rwBinPrimCount2;
+RWStructuredBuffer<TilePrim> g_rwBinPrimitives0;
+RWStructuredBuffer<TilePrim> g_rwBinPrimitives1;
+RWStructuredBuffer<TilePrim> g_rwBinPrimitives2;
+RWStructuredBuffer<uint> g_rwAreaHistogram;
+RWStructuredBuffer<uint> g_rwRejectedCount;
+RWStructuredBuffer<uint> g_rwRejectedArgs;
+RWStructuredBuffer<uint> g_rwRejectedPrims;
 
-RWStructuredBuffer<uint> g_rwBinPrimCount;
-RWStructuredBuffer<TilePrim> g_rwBinPrimitives;
+//--------------------------------------------------------------------------------------
+// Texture
+//--------------------------------------------------------------------------------------
+Texture2D<uint> g_txDepthPyramid;	// Mip i holds the max depth of 2^(i+1) x 2^(i+1) pixels
+
+groupshared uint g_areaHistogram[AREA_HISTOGRAM_SIZE];
 
 //--------------------------------------------------------------------------------------
 // Cull a primitive to the view frustum defined in clip space.
@@ -70,12 +92,41 @@ bool CullPrimitive(float3x4 primVPos)
 	return isFullOutside;
 }
 
+//--------------------------------------------------------------------------------------
+// Test the screen-space primitive against the depth pyramid.
+//--------------------------------------------------------------------------------------
+bool IsPrimitiveOccluded(float3x4 primVPos, uint4 scissor)
+{
+	// The primitives crossing the near plane are not tested.
+	const uint zMin = DepthKeyRange(primVPos).x;
+	const float rhwMin = min(primVPos[0].w, min(primVPos[1].w, primVPos[2].w));
+	if (rhwMin <= 0.0) return false;
+
+	const float2 minPt = min(primVPos[0].xy, min(primVPos[1].xy, primVPos[2].xy));
+	const float2 maxPt = max(primVPos[0].xy, max(primVPos[1].xy, primVPos[2].xy));
+
+	return IsOccluded(g_txDepthPyramid, minPt, min(maxPt, scissor.zw), zMin);
+}
+
+//--------------------------------------------------------------------------------------
+// Record the rejected primitive for the re-test pass.
+//--------------------------------------------------------------------------------------
+void RejectPrimitive(uint primId)
+{
+	uint idx;
+	InterlockedAdd(g_rwRejectedCount[0], 1, idx);
+	g_rwRejectedPrims[idx] = primId;
+
+	// Indirect dispatch arguments of the re-test pass, one group per 64 rejected primitives
+	if (idx % 64 == 0) InterlockedAdd(g_rwRejectedArgs[0], 1);
+}
+
 //--------------------------------------------------------------------------------------
 // Compute the minimum pixel as well as the maximum pixel
 // possibly overlapped by the primitive.
 //--------------------------------------------------------------------------------------
 void ComputeAABB(float3x4 primVPos, out uint2 minTile,
-	out uint2 maxTile, TileInfo tileInfo)
+	out uint2 maxTile, TileInfo tileInfo, uint4 scissor)
 {
 	const float2 minPt = min(primVPos[0].xy, min(primVPos[1].xy, primVPos[2].xy));
 	const float2 maxPt = max(primVPos[0].xy, max(primVPos[1].xy, primVPos[2].xy));
@@ -89,6 +140,12 @@ void ComputeAABB(float3x4 primVPos, out uint2 minTile,
 
 	minTile = max(minTile, 0);
 	maxTile = min(maxTile + 1, tileInfo.Dim);
+
+	// Clamp to the scissor rectangle of the view, where the scan lines stop before
+	// maxTile.x, and the rows go through maxTile.y.
+	const uint4 scissorTiles = GetScissorTiles(scissor, tileInfo.SizeLog);
+	minTile = max(minTile, scissorTiles.xy);
+	maxTile = min(maxTile, uint2(scissorTiles.z, scissorTiles.w - 1));
 }
 
 //--------------------------------------------------------------------------------------
@@ -121,7 +178,13 @@ void AppendPrimitive(uint primId, uint tileY, inout uint3 scanLine,
 #else
 	InterlockedAdd(uavInfo.rwPrimCount[0], scanLineLen, baseIdx);
 #endif
-	for (uint i = 0; i < scanLineLen; ++i)
+
+	// The entries beyond the capacity are dropped, e.g., on the coarse bin levels, and the
+	// refining passes skip the count beyond it
+	uint numEntries, stride;
+	uavInfo.rwPrimitives.GetDimensions(numEntries, stride);
+	const uint appendLen = baseIdx < numEntries ? min(scanLineLen, numEntries - baseIdx) : 0;
+	for (uint i = 0; i < appendLen; ++i)
 	{
 		uavInfo.rwPrimitives[baseIdx + i] = tilePrim;
 		++tilePrim.TileIdx;
@@ -177,7 +240,7 @@ void BinPrimitive(uint primId, uint tileDimX, RasterInfo rasterInfo)
 			for (uint j = scanLine.x; j < scanLine.y; ++j)
 			{
 				tile.x = j;
-				if (j > scanLine.x + 2 && j + 3 < scanLine.y && isInsideY)
+				if (IsDepthOrdered() && j > scanLine.x + 2 && j + 3 < scanLine.y && isInsideY)
 					InterlockedMin(uavInfo.rwHiZ[tile], zMax, hiZ);
 				else
 				{
@@ -185,7 +248,7 @@ void BinPrimitive(uint primId, uint tileDimX, RasterInfo rasterInfo)
 					hiZ = uavInfo.rwHiZ[tile];
 				}
 
-				if (hiZ < zMin)
+				if (!HiZTest(zMin, hiZ))
 				{
 					// Depth Test failed for this tile
 					scanLine.y = j;
@@ -199,47 +262,50 @@ void BinPrimitive(uint primId, uint tileDimX, RasterInfo rasterInfo)
 }
 
 //--------------------------------------------------------------------------------------
-// Get tile info.
+// Get tile info, and return the level, where level 0 is the tiles.
 //--------------------------------------------------------------------------------------
-bool GetTileInfo(float3x4 primVPos, out TileInfo tileInfo)
+uint GetTileInfo(float3x4 primVPos, out TileInfo tileInfo)
 {
 	const float area = determinant(primVPos[0].xy, primVPos[1].xy, primVPos[2].xy);
-	if (USE_TRIPPLE_RASTER && area > (TILE_SIZE * TILE_SIZE)* (4.0 * 4.0))
-	{
-		// If the area > 4x4 tile sizes, the bin rasterization will be triggered.
-		tileInfo.SizeLog = BIN_SIZE_LOG;
-		tileInfo.Size = BIN_SIZE;
-		tileInfo.Dim = g_binDim;
 
-		return true;
-	}
-	else
+	// If the area > the threshold chosen from the area histogram, the bin rasterization will be triggered.
+	// Each coarser bin level takes the primitives over the threshold scaled by its area ratio.
+	uint level = 0;
+	float threshold = g_binThreshold;
+	[unroll]
+	for (uint i = 0; i < MAX_BIN_LEVELS; ++i)
 	{
-		// Otherwise, the tile rasterization is directly done.
-		tileInfo.SizeLog = TILE_SIZE_LOG;
-		tileInfo.Size = TILE_SIZE;
-		tileInfo.Dim = g_tileDim;
-
-		return false;
+		if (i < g_numBinLevels && area > threshold) level = i + 1;
+		threshold *= 1 << (2 * TILE_TO_BIN_LOG);
 	}
+
+	// Otherwise, the tile rasterization is directly done.
+	tileInfo.SizeLog = TILE_SIZE_LOG + TILE_TO_BIN_LOG * level;
+	tileInfo.Size = 1 << tileInfo.SizeLog;
+
+	const uint dimLog = TILE_TO_BIN_LOG * max(level, 1) - TILE_TO_BIN_LOG;
+	tileInfo.Dim = level > 0 ? (g_binDim + (1 << dimLog) - 1) >> dimLog : g_tileDim;
+
+	return level;
 }
 
 //--------------------------------------------------------------------------------------
 // Determine all potentially overlapping tiles.
 //--------------------------------------------------------------------------------------
-void ProcessPrimitive(float3x4 primVPos, uint primId)
+void ProcessPrimitive(float3x4 primVPos, uint primId, uint4 scissor)
 {
 	// Get tile info
 	TileInfo tileInfo;
-	const bool useBin = GetTileInfo(primVPos, tileInfo);
+	const uint level = GetTileInfo(primVPos, tileInfo);
 
 	RasterInfo rasterInfo;
 
 	// Create the AABB.
-	ComputeAABB(primVPos, rasterInfo.MinTile, rasterInfo.MaxTile, tileInfo);
+	ComputeAABB(primVPos, rasterInfo.MinTile, rasterInfo.MaxTile, tileInfo, scissor);
 
-	rasterInfo.ZMin = asuint(min(primVPos[0].z, min(primVPos[1].z, primVPos[2].z)));
-	rasterInfo.ZMax = asuint(max(primVPos[0].z, max(primVPos[1].z, primVPos[2].z)));
+	const uint2 zRange = DepthKeyRange(primVPos);
+	rasterInfo.ZMin = zRange.x;
+	rasterInfo.ZMax = zRange.y;
 
 	// Scale the primitive for conservative rasterization.
 	float3x2 v;
@@ -262,12 +328,27 @@ void ProcessPrimitive(float3x4 primVPos, uint primId)
 	rasterInfo.w.z = determinant(v[0], v[1], minPt);
 	rasterInfo.MinPt = minPt;
 
-	if (useBin)
+	if (level > 2)
+	{
+		// Need bin rasterization at the coarsest level.
+		rasterInfo.UavInfo.rwPrimCount = g_rwBinPrimCount2;
+		rasterInfo.UavInfo.rwPrimitives = g_rwBinPrimitives2;
+		rasterInfo.UavInfo.rwHiZ = g_rwBinZ2;
+		BinPrimitive(primId, tileInfo.Dim.x, rasterInfo);
+	}
+	else if (level > 1)
+	{
+		rasterInfo.UavInfo.rwPrimCount = g_rwBinPrimCount1;
+		rasterInfo.UavInfo.rwPrimitives = g_rwBinPrimitives1;
+		rasterInfo.UavInfo.rwHiZ = g_rwBinZ1;
+		BinPrimitive(primId, tileInfo.Dim.x, rasterInfo);
+	}
+	else if (level > 0)
 	{
 		// Need bin rasterization.
-		rasterInfo.UavInfo.rwPrimCount = g_rwBinPrimCount;
-		rasterInfo.UavInfo.rwPrimitives = g_rwBinPrimitives;
-		rasterInfo.UavInfo.rwHiZ = g_rwBinZ;
+		rasterInfo.UavInfo.rwPrimCount = g_rwBinPrimCount0;
+		rasterInfo.UavInfo.rwPrimitives = g_rwBinPrimitives0;
+		rasterInfo.UavInfo.rwHiZ = g_rwBinZ0;
 		BinPrimitive(primId, tileInfo.Dim.x, rasterInfo);
 	}
 	else
@@ -336,7 +417,7 @@ void BinPrimitive2(float3x4 primVPos, uint primId)
 {
 	// Get tile info
 	TileInfo tileInfo;
-	const bool useBin = GetTileInfo(primVPos, tileInfo);
+	const uint level = GetTileInfo(primVPos, tileInfo);
 
 	// To tiled space.
 	float2 v[3], rangeY;
@@ -400,21 +481,57 @@ void BinPrimitive2(float3x4 primVPos, uint primId)
 #endif
 
 [numthreads(64, 1, 1)]
-void main(uint DTid : SV_DispatchThreadID)
+void main(uint DTid : SV_DispatchThreadID, uint GTid : SV_GroupThreadID)
 {
+	if (GTid < AREA_HISTOGRAM_SIZE) g_areaHistogram[GTid] = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// The re-test pass walks the primitives rejected by the first pass, and the culled
+	// draws leave the primitives after g_numDrawPrims of each view unwritten.
+	const bool isRetest = g_occlusionPass > 1;
+	const uint primId = isRetest ? (DTid < g_rwRejectedCount[0] ? g_rwRejectedPrims[DTid] : 0xffffffff) :
+		(DTid % g_numViewPrims < g_numDrawPrims ? DTid : 0xffffffff);
+
 	float3x4 primVPos;
 
 	// Load the vertex positions of the triangle
-	const uint baseVIdx = DTid * 3;
+	const uint baseVIdx = primId * 3;
 	[unroll]
 	for (uint i = 0; i < 3; ++i) primVPos[i] = g_rwVertexPos[baseVIdx + i];
 
 	// Cull the primitive.
-	if (CullPrimitive(primVPos)) return;
+	bool isVisible = primId != 0xffffffff && !CullPrimitive(primVPos);
+
+	// The primitives are binned into the cells of their views only.
+	const float4 viewport = GetViewport(primId);
+	const uint4 scissor = GetScissor(viewport);
+
+	if (isVisible)
+	{
+		// To screen space.
+		ToScreenSpace(primVPos, viewport);
+
+		// Log2 histogram of the areas, from which the bin threshold of the next frames is chosen
+		const float area = determinant(primVPos[0].xy, primVPos[1].xy, primVPos[2].xy);
+		if (area > 0.0 && !isRetest)
+		{
+			const uint bucket = area >= 1.0 ? min(firstbithigh((uint)area), AREA_HISTOGRAM_SIZE - 1) : 0;
+			InterlockedAdd(g_areaHistogram[bucket], 1);
+		}
+	}
 
-	// To screen space.
-	ToScreenSpace(primVPos);
+	GroupMemoryBarrierWithGroupSync();
+	if (GTid < AREA_HISTOGRAM_SIZE && g_areaHistogram[GTid] > 0)
+		InterlockedAdd(g_rwAreaHistogram[GTid], g_areaHistogram[GTid]);
+
+	// Occlusion culling against the depth pyramid, which is of the previous frame in the
+	// first pass, and of the first pass in the re-test pass.
+	if (isVisible && g_occlusionPass > 0 && IsPrimitiveOccluded(primVPos, scissor))
+	{
+		isVisible = false;
+		if (!isRetest) RejectPrimitive(primId);
+	}
 
 	// Store each successful clipping result.
-	ProcessPrimitive(primVPos, DTid);
+	if (isVisible) ProcessPrimitive(primVPos, primId, scissor);
 }
@@ -16,35 +16,153 @@ struct TilePrim
 //--------------------------------------------------------------------------------------
 cbuffer cb
 {
-	float4	g_viewport;	// X, Y, W, H
+	float4	g_viewport;	// X, Y, W, H of the first view, the others follow in a grid of the same sizes
 	uint2	g_tileDim;
 	uint2	g_binDim;
+	uint	g_blendMode;
+	float	g_binThreshold;	// Doubled screen-space area over which the primitives are binned
+	uint	g_numBinLevels;
+	uint	g_refineSizeLog;	// Child tile size of the refine pass
+	uint	g_occlusionPass;	// 0: no occlusion culling, 1: cull and record the rejected, 2: re-test the rejected
+	uint	g_depthFunc;	// Comparison of the depth keys, of which the smaller is the nearer
+	uint	g_depthFlip;	// 0x7fffffff for reverse-Z, otherwise 0
+	uint	g_depthWrite;
+	uint4	g_scissor;	// Left, top, right, and bottom in pixels, within the views
+	uint	g_numViewPrims;	// Primitives of all the draws and instances per view, of which the IDs are consecutive
+	uint	g_viewColumns;
+	uint	g_numDrawPrims;	// Primitives drawn per view, fewer than g_numViewPrims if the draws are culled on the GPU
+	uint	g_shadingRateLog;	// Log2 of the coarse pixel size of the draw
+	uint	g_hasRateImage;
 };
 
+//--------------------------------------------------------------------------------------
+// Depth key, of which the smaller is the nearer. The bits of the positive floats keep
+// the order, and flipping all the bits but the sign reverses the order for reverse-Z.
+//--------------------------------------------------------------------------------------
+uint DepthKey(float z)
+{
+	return asuint(z) ^ g_depthFlip;
+}
+
+//--------------------------------------------------------------------------------------
+// Nearest and farthest depth keys of a primitive.
+//--------------------------------------------------------------------------------------
+uint2 DepthKeyRange(float3x4 primVPos)
+{
+	const uint3 z = { DepthKey(primVPos[0].z), DepthKey(primVPos[1].z), DepthKey(primVPos[2].z) };
+
+	return uint2(min(z.x, min(z.y, z.z)), max(z.x, max(z.y, z.z)));
+}
+
+//--------------------------------------------------------------------------------------
+// Depth test of a fragment against the stored depth.
+//--------------------------------------------------------------------------------------
+bool DepthTest(uint z, uint depth)
+{
+	switch (g_depthFunc)
+	{
+	case DEPTH_LESS:
+		return z < depth;
+	case DEPTH_EQUAL:
+		return z == depth;
+	case DEPTH_NOT_EQUAL:
+		return z != depth;
+	case DEPTH_ALWAYS:
+		return true;
+	default:
+		return z <= depth;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Conservative depth test of the nearest depth of a primitive against the farthest
+// depth of a tile, which cannot reject anything for the unordered comparisons.
+//--------------------------------------------------------------------------------------
+bool HiZTest(uint zMin, uint hiZ)
+{
+	return g_depthFunc > DEPTH_EQUAL || zMin <= hiZ;
+}
+
+//--------------------------------------------------------------------------------------
+// The depth only gets nearer, so the farthest depth of a tile can be lowered by the
+// primitives fully covering it.
+//--------------------------------------------------------------------------------------
+bool IsDepthOrdered()
+{
+	return g_depthWrite && g_depthFunc <= DEPTH_LESS_EQUAL;
+}
+
 //--------------------------------------------------------------------------------------
 // Transform a vector in homogeneous clip space to the screen space.
 // --> First does perspective division to get the normalized device coordinates.
 // --> Then scales the coordinates to the whole screen.
 //--------------------------------------------------------------------------------------
-float4 ClipToScreen(float4 pos)
+float4 ClipToScreen(float4 pos, float4 viewport)
 {
 	const float rhw = 1.0 / pos.w;
 	pos.xyz *= rhw;
 	pos.y = -pos.y;
 	pos.xy = pos.xy * 0.5 + 0.5;
-	pos.xy = pos.xy * g_viewport.zw;
+	pos.xy = pos.xy * viewport.zw + viewport.xy;
 
 	return float4(pos.xyz, rhw);
 }
 
+//--------------------------------------------------------------------------------------
+// Viewport of the view that the primitive is broadcast to, in the atlas of the views.
+//--------------------------------------------------------------------------------------
+float4 GetViewport(uint primId)
+{
+	const uint view = primId / g_numViewPrims;
+	const uint2 cell = uint2(view % g_viewColumns, view / g_viewColumns);
+
+	return float4(g_viewport.xy + cell * g_viewport.zw, g_viewport.zw);
+}
+
+//--------------------------------------------------------------------------------------
+// Scissor rectangle within a viewport, whose pixel centers are inside, so that the
+// neighboring views in the atlas never overlap.
+//--------------------------------------------------------------------------------------
+uint4 GetScissor(float4 viewport)
+{
+	const uint4 rect = uint4(ceil(viewport.xy - 0.5), ceil(viewport.xy + viewport.zw - 0.5));
+
+	return uint4(max(rect.xy, g_scissor.xy), min(rect.zw, g_scissor.zw));
+}
+
+//--------------------------------------------------------------------------------------
+// Tile range of the scissor rectangle at the tile size of 2^sizeLog, where the max is exclusive.
+//--------------------------------------------------------------------------------------
+uint4 GetScissorTiles(uint4 scissor, uint sizeLog)
+{
+	return uint4(scissor.xy >> sizeLog, (scissor.zw + (1 << sizeLog) - 1) >> sizeLog);
+}
+
+//--------------------------------------------------------------------------------------
+// Check if the pixel is inside the scissor rectangle.
+//--------------------------------------------------------------------------------------
+bool IsInScissor(uint2 pixelPos, uint4 scissor)
+{
+	return all(pixelPos >= scissor.xy) && all(pixelPos < scissor.zw);
+}
+
+//--------------------------------------------------------------------------------------
+// Check if the tile of 2^sizeLog is fully inside the scissor rectangle, otherwise the
+// pixels outside keep the depths of the other views, which the Hi-Z cannot skip.
+//--------------------------------------------------------------------------------------
+bool IsTileInScissor(uint2 tile, uint sizeLog, uint4 scissor)
+{
+	return all(tile << sizeLog >= scissor.xy) && all((tile + 1) << sizeLog <= scissor.zw);
+}
+
 //--------------------------------------------------------------------------------------
 // Transform a primitive given in clip space to screen space.
 //--------------------------------------------------------------------------------------
-void ToScreenSpace(inout float3x4 primVPos)
+void ToScreenSpace(inout float3x4 primVPos, float4 viewport)
 {
 	[unroll]
 	for (uint i = 0; i < 3; ++i)
-		primVPos[i] = ClipToScreen(primVPos[i]);
+		primVPos[i] = ClipToScreen(primVPos[i], viewport);
 }
 
 //--------------------------------------------------------------------------------------
@@ -0,0 +1,44 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cb
+{
+	uint g_isReadback;	// The mip is also copied to the buffer read back by the CPU
+};
+
+//--------------------------------------------------------------------------------------
+// UAV buffers
+//--------------------------------------------------------------------------------------
+RWTexture2D<uint> g_rwSrc;	// PixelZ for mip 0, otherwise the previous mip
+RWTexture2D<uint> g_rwDst;
+RWStructuredBuffer<uint> g_rwReadback;
+
+//--------------------------------------------------------------------------------------
+// Downsample the depth by the max of each 2x2 quad, the out-of-bound reads are 0, so
+// the odd edges of PixelZ keep the max of the covered texels only. The mips are halved
+// with the floor, so the last row and column also take the extra edge texel of an odd-
+// sized source mip, and the last texels cover the remainder of the screen.
+//--------------------------------------------------------------------------------------
+[numthreads(8, 8, 1)]
+void main(uint2 DTid : SV_DispatchThreadID)
+{
+	uint2 dim, srcDim;
+	g_rwDst.GetDimensions(dim.x, dim.y);
+	g_rwSrc.GetDimensions(srcDim.x, srcDim.y);
+
+	const uint2 pos = DTid << 1;
+	const uint2 last = DTid == dim - 1 ? max(srcDim - 1, pos + 1) : pos + 1;
+
+	uint zMax = 0;
+	for (uint y = pos.y; y <= last.y; ++y)
+		for (uint x = pos.x; x <= last.x; ++x)
+			zMax = max(g_rwSrc[uint2(x, y)], zMax);
+
+	g_rwDst[DTid] = zMax;
+
+	if (g_isReadback && all(DTid < dim)) g_rwReadback[dim.x * DTid.y + DTid.x] = zMax;
+}
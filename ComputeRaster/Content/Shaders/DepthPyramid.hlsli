@@ -0,0 +1,37 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Test a screen rectangle in pixels, [minPt, maxPt), of the nearest depth key zMin against
+// the depth pyramid, whose mip i holds the max depth key of 2^(i+1) x 2^(i+1) pixels, where
+// the last row and column also cover the remaining pixels, so the edges clamp onto them.
+//--------------------------------------------------------------------------------------
+bool IsOccluded(Texture2D<uint> depthPyramid, float2 minPt, float2 maxPt, uint zMin)
+{
+	// The negative depths keep the sign bit in the keys, and are not tested.
+	if (zMin & 0x80000000) return false;
+
+	minPt = max(minPt, 0.0);
+	maxPt = max(maxPt - 0.5, minPt);
+
+	// Choose the mip whose texels are larger than the rectangle, so that it overlaps 2x2 texels at most.
+	uint2 dim;
+	uint numMips;
+	depthPyramid.GetDimensions(0, dim.x, dim.y, numMips);
+	const float2 size = maxPt - minPt;
+	const uint mip = min(firstbithigh(max((uint)ceil(max(size.x, size.y)), 1)), numMips - 1);
+	depthPyramid.GetDimensions(mip, dim.x, dim.y, numMips);
+
+	const uint2 minTexel = min((uint2)minPt >> (mip + 1), dim - 1);
+	const uint2 maxTexel = min((uint2)maxPt >> (mip + 1), dim - 1);
+	const uint4 z =
+	{
+		depthPyramid.Load(uint3(minTexel, mip)),
+		depthPyramid.Load(uint3(maxTexel.x, minTexel.y, mip)),
+		depthPyramid.Load(uint3(minTexel.x, maxTexel.y, mip)),
+		depthPyramid.Load(uint3(maxTexel, mip))
+	};
+
+	return zMin > max(max(z.x, z.y), max(z.z, z.w));
+}
@@ -0,0 +1,224 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+#include "Common.hlsli"
+#include "DepthPyramid.hlsli"
+
+#define GROUP_SIZE 1024
+
+//--------------------------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------------------------
+struct DrawObject
+{
+	uint NumVertices;	// Indices per instance
+	uint NumInstances;
+	uint StartVertex;	// Start index
+	int BaseVertex;
+	uint BaseInstance;
+	float3 BoundMin;	// Bounds of all the instances in the space of g_cullViewProj
+	float3 BoundMax;
+	float3 ConeAxis;	// Normal cone of the meshlets, where the cutoff 1 disables the back-face test
+	float ConeCutoff;
+};
+
+struct DrawRecord
+{
+	uint NumVertices;
+	uint NumInstances;
+	uint StartVertex;
+	int BaseVertex;
+	uint BaseInstance;
+	uint VertexOffset;
+	uint DrawId;
+};
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbCull
+{
+	matrix	g_cullViewProj;
+	float4	g_cullEyePt;	// In the space of g_cullViewProj, w = 0 for the orthographic projections
+	uint	g_numObjects;
+	uint	g_numViews;
+	uint	g_cullPass;	// 0: frustum only, 1: also the depth pyramid, recording the rejected, 2: re-test the rejected
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers and texture
+//--------------------------------------------------------------------------------------
+StructuredBuffer<DrawObject> g_roObjects;
+Texture2D<uint> g_txDepthPyramid;	// Mip i holds the max depth of 2^(i+1) x 2^(i+1) pixels
+
+//--------------------------------------------------------------------------------------
+// UAV buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<DrawRecord> g_rwDrawRecords;
+RWStructuredBuffer<uint> g_rwDrawArgs;	// Root constants and dispatch arguments of the vertex stage and the bin raster
+RWStructuredBuffer<uint> g_rwRejectedObjects;	// The count, followed by the object indices
+
+groupshared uint2 g_scan[GROUP_SIZE];
+
+//--------------------------------------------------------------------------------------
+// Cull the bounding box to the view frustum defined in clip space, where the box is
+// outside if all its corners are outside the same plane.
+//--------------------------------------------------------------------------------------
+bool CullBox(float4 corners[8])
+{
+	bool3 isOutsideMin = true, isOutsideMax = true;
+
+	[unroll]
+	for (uint i = 0; i < 8; ++i)
+	{
+		isOutsideMin = isOutsideMin && corners[i].xyz < float3(-corners[i].ww, 0.0);
+		isOutsideMax = isOutsideMax && corners[i].xyz > corners[i].w;
+	}
+
+	return any(isOutsideMin) || any(isOutsideMax);
+}
+
+//--------------------------------------------------------------------------------------
+// Cull the clusters of which all the triangles face away from the eye point, where the
+// bounding sphere of the box bounds the apex of the normal cone.
+//--------------------------------------------------------------------------------------
+bool CullCone(DrawObject object)
+{
+	if (g_cullEyePt.w <= 0.0 || object.ConeCutoff >= 1.0) return false;
+
+	const float3 center = (object.BoundMin + object.BoundMax) * 0.5;
+	const float radius = length(object.BoundMax - object.BoundMin) * 0.5;
+	const float3 viewDir = center - g_cullEyePt.xyz;
+
+	return dot(viewDir, object.ConeAxis) >= object.ConeCutoff * length(viewDir) + radius;
+}
+
+//--------------------------------------------------------------------------------------
+// Test the screen-space rectangle of the bounding box against the depth pyramid.
+//--------------------------------------------------------------------------------------
+bool IsBoxOccluded(float4 corners[8])
+{
+	float2 minPt = 1e10, maxPt = -1e10;
+	uint zMin = 0xffffffff;
+
+	[unroll]
+	for (uint i = 0; i < 8; ++i)
+	{
+		// The boxes crossing the near plane are not tested.
+		if (corners[i].w <= 0.0) return false;
+
+		const float4 pos = ClipToScreen(corners[i], g_viewport);
+		minPt = min(pos.xy, minPt);
+		maxPt = max(pos.xy, maxPt);
+		zMin = min(DepthKey(pos.z), zMin);
+	}
+
+	return IsOccluded(g_txDepthPyramid, minPt, min(maxPt, g_scissor.zw), zMin);
+}
+
+//--------------------------------------------------------------------------------------
+// Check the visibility of the object, and record the occluded ones for the re-test pass.
+//--------------------------------------------------------------------------------------
+bool IsVisible(DrawObject object, uint objectId)
+{
+	float4 corners[8];
+
+	[unroll]
+	for (uint i = 0; i < 8; ++i)
+	{
+		const float3 pos = float3(i & 1 ? object.BoundMax.x : object.BoundMin.x,
+			i & 2 ? object.BoundMax.y : object.BoundMin.y, i & 4 ? object.BoundMax.z : object.BoundMin.z);
+		corners[i] = mul(float4(pos, 1.0), g_cullViewProj);
+	}
+
+	if (CullBox(corners) || CullCone(object)) return false;
+
+	// The first pass tests against the depth pyramid of the previous frame, and the re-test pass
+	// tests against the one of the first pass.
+	if (g_cullPass > 0 && IsBoxOccluded(corners))
+	{
+		if (g_cullPass == 1)
+		{
+			uint idx;
+			InterlockedAdd(g_rwRejectedObjects[0], 1, idx);
+			g_rwRejectedObjects[idx + 1] = objectId;
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Cull the objects, and compact the visible ones into the draw records in the order of
+// the objects. One group walks over all the objects chunk by chunk, carrying the running
+// totals of the draws and the vertices.
+//--------------------------------------------------------------------------------------
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint GTid : SV_GroupThreadID)
+{
+	const bool isRetest = g_cullPass > 1;
+	const uint numObjects = isRetest ? g_rwRejectedObjects[0] : g_numObjects;
+
+	uint2 carry = 0;
+	for (uint n = 0; n < numObjects; n += GROUP_SIZE)
+	{
+		const uint i = n + GTid;
+		const uint objectId = isRetest ? (i < numObjects ? g_rwRejectedObjects[i + 1] : 0) : i;
+		const DrawObject object = g_roObjects[objectId];
+
+		// Draw and vertex counts
+		const uint numVertices = object.NumVertices / 3 * 3;
+		uint2 count = 0;
+		if (i < numObjects && numVertices * object.NumInstances > 0)
+			if (IsVisible(object, objectId)) count = uint2(1, numVertices * object.NumInstances);
+		g_scan[GTid] = count;
+		GroupMemoryBarrierWithGroupSync();
+
+		// Inclusive scan in groupshared memory
+		for (uint s = 1; s < GROUP_SIZE; s <<= 1)
+		{
+			const uint2 value = GTid >= s ? g_scan[GTid - s] : 0;
+			GroupMemoryBarrierWithGroupSync();
+			g_scan[GTid] += value;
+			GroupMemoryBarrierWithGroupSync();
+		}
+
+		if (count.x > 0)
+		{
+			const uint2 offset = carry + g_scan[GTid] - count;
+			DrawRecord record;
+			record.NumVertices = numVertices;
+			record.NumInstances = object.NumInstances;
+			record.StartVertex = object.StartVertex;
+			record.BaseVertex = object.BaseVertex;
+			record.BaseInstance = object.BaseInstance;
+			record.VertexOffset = offset.y;
+			record.DrawId = objectId;
+			g_rwDrawRecords[offset.x] = record;
+		}
+
+		carry += g_scan[GROUP_SIZE - 1];
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// The draw count for the vertex stage, and the drawn primitive count per view for the
+	// bin raster, each followed by the dispatch arguments, where the primitives of the
+	// other views are at the strides of g_numViewPrims.
+	if (GTid == 0)
+	{
+		const uint numPrims = carry.y / 3;
+		const uint numVertexGroups = (carry.y + 63) / 64;
+		g_rwDrawArgs[0] = carry.x;
+		g_rwDrawArgs[1] = min(numVertexGroups, VERTEX_GROUP_ROW);
+		g_rwDrawArgs[2] = (numVertexGroups + VERTEX_GROUP_ROW - 1) / VERTEX_GROUP_ROW;
+		g_rwDrawArgs[3] = 1;
+		g_rwDrawArgs[4] = numPrims;
+		g_rwDrawArgs[5] = numPrims > 0 ? (g_numViewPrims * (g_numViews - 1) + numPrims + 63) / 64 : 0;
+		g_rwDrawArgs[6] = 1;
+		g_rwDrawArgs[7] = 1;
+	}
+}
@@ -2,123 +2,84 @@
 // Copyright (c) XU, Tianchen. All rights reserved.
 //--------------------------------------------------------------------------------------
 
-#include "SharedConst.h"
-#define main PSMain
-#include "PixelShader.hlsl"
-#undef main
-#include "Common.hlsli"
-
-#define CR_PRIMITIVE_VERTEX_ATTRIBUTE_TYPE(t, c) t##3x##c
-#define CR_ATTRIBUTE_GEN_TYPE(t, c) t##c
-#define CR_ATTRIBUTE_TYPE(n) CR_ATTRIBUTE_GEN_TYPE(CR_ATTRIBUTE_BASE_TYPE##n, CR_ATTRIBUTE_COMPONENT_COUNT##n)
-
-#define COMPUTE_ATTRIBUTE_float(n) \
-	{ \
-		CR_PRIMITIVE_VERTEX_ATTRIBUTE_TYPE(CR_ATTRIBUTE_BASE_TYPE##n, CR_ATTRIBUTE_COMPONENT_COUNT##n) primVAtt; \
-		[unroll] \
-		for (i = 0; i < 3; ++i) primVAtt[i] = g_roVertexAtt##n[baseVIdx + i]; \
-		input.CR_ATTRIBUTE##n = mul(persp, primVAtt); \
-	}
-
-#define COMPUTE_ATTRIBUTE_min16float(n) COMPUTE_ATTRIBUTE_float(n)
-#define COMPUTE_ATTRIBUTE_int(n) input.CR_ATTRIBUTE##n = g_roVertexAtt##n[baseVIdx]
-#define COMPUTE_ATTRIBUTE_uint(n) COMPUTE_ATTRIBUTE_int(n)
-#define COMPUTE_ATTRIBUTE_min16int(n) COMPUTE_ATTRIBUTE_int(n)
-#define COMPUTE_ATTRIBUTE_min16uint(n) COMPUTE_ATTRIBUTE_int(n)
-#define COMPUTE_ATTRIBUTE_bool(n) COMPUTE_ATTRIBUTE_int(n)
-
-#define COMPUTE_ATTRIBUTE(t, n) COMPUTE_ATTRIBUTE_##t(n)
-#define SET_ATTRIBUTE(n) COMPUTE_ATTRIBUTE(CR_ATTRIBUTE_BASE_TYPE##n, n)
-
-#define DEFINED_ATTRIBUTE(n) (defined(CR_ATTRIBUTE_BASE_TYPE##n) && defined(CR_ATTRIBUTE_COMPONENT_COUNT##n))
-#define DECLARE_ATTRIBUTE(n) Buffer<CR_ATTRIBUTE_TYPE(n)> g_roVertexAtt##n
-
-#define SET_TARGET(n) g_rwRenderTarget##n[pixelPos] = output.CR_TARGET##n
-#define DEFINED_TARGET(n) (defined(CR_TARGET_TYPE##n) && defined(CR_TARGET##n))
-#define DECLARE_TARGET(n) RWTexture2D<CR_TARGET_TYPE##n> g_rwRenderTarget##n
-
-#define USE_MUTEX 1
+#include "PixelRaster.hlsli"
 
-//--------------------------------------------------------------------------------------
-// Buffers
-//--------------------------------------------------------------------------------------
-StructuredBuffer<TilePrim> g_roTilePrimitives;
-#include "DeclareAttributes.hlsli"
+#if SHADING_RATE
+// Per coarse pixel of at least 2x2 pixels, where the full-rate pixels shade themselves
+#define COARSE_TILE_SIZE (TILE_SIZE >> 1)
+groupshared uint g_shadingLanes[COARSE_TILE_SIZE * COARSE_TILE_SIZE];
+groupshared CR_OUT_STRUCT_TYPE g_shadedOutputs[COARSE_TILE_SIZE * COARSE_TILE_SIZE];
+#endif
 
 //--------------------------------------------------------------------------------------
-// UAV buffers
+// Coverage and depth of the pixel, with the normalized barycentric coordinates.
 //--------------------------------------------------------------------------------------
-RWStructuredBuffer<float4> g_rwVertexPos;
-#include "DeclareTargets.hlsli"
-
-globallycoherent
-RWTexture2D<uint> g_rwDepth;
-RWTexture2D<uint> g_rwHiZ;
-
-[numthreads(8, 8, 1)]
-void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx : SV_GroupIndex)
+bool RasterizePixel(out PSIn input, out float3 w, out uint depth, float3x4 primVPos, uint2 pixelPos, uint primId)
 {
-	const TilePrim tilePrim = g_roTilePrimitives[Gid];
-	const uint2 tile = uint2(tilePrim.TileIdx % g_tileDim.x, tilePrim.TileIdx / g_tileDim.x);
-
-	float3x4 primVPos;
-
-	// Load the vertex positions of the triangle
-	const uint baseVIdx = tilePrim.PrimId * 3;
-	[unroll]
-	for (uint i = 0; i < 3; ++i) primVPos[i] = g_rwVertexPos[baseVIdx + i];
-
-	// To screen space.
-	ToScreenSpace(primVPos);
+	input = (PSIn)0;
+	w = 0.0;
+	depth = 0xffffffff;
+	if (!IsInScissor(pixelPos, GetScissor(GetViewport(primId)))) return false;
 
-#if RE_HI_Z
-	const uint zMin = asuint(min(primVPos[0].z, min(primVPos[1].z, primVPos[2].z)));
-	if (g_rwHiZ[tile] < zMin) return;
-#endif
-
-	PSIn input;
-	float3 w;
-	const uint2 pixelPos = (tile << TILE_SIZE_LOG) + GTid;
 	input.Pos.xy = pixelPos + 0.5;
-	if (!Overlap(input.Pos.xy, (float3x2)primVPos, w)) return;
+	if (!Overlap(input.Pos.xy, (float3x2)primVPos, w)) return false;
 
 	// Normalize barycentric coordinates.
 	const float area = determinant(primVPos[0].xy, primVPos[1].xy, primVPos[2].xy);
-	if (area <= 0.0) return;
+	if (area <= 0.0) return false;
 	w /= area;
 
-	// Depth test
-	uint depthMin;
 	input.Pos.z = w.x * primVPos[0].z + w.y * primVPos[1].z + w.z * primVPos[2].z;
-	const uint depth = asuint(input.Pos.z);
-#if USE_MUTEX > 1
-	// Mutual exclusive writing
-	[allow_uav_condition]
-	for (i = 0, depthMin = 0xffffffff; i < 0xffffffff && depthMin == 0xffffffff; ++i)
+	depth = DepthKey(input.Pos.z);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Depth test before shading, which is final for the depth-ordered tests.
+//--------------------------------------------------------------------------------------
+bool EarlyDepthTest(uint2 pixelPos, uint depth)
+{
+	uint i, depthMin;
+	if (IsDepthOrdered())
 	{
-		InterlockedExchange(g_rwDepth[pixelPos], 0xffffffff, depthMin);
-		if (depthMin != 0xffffffff)
-			// Critical section
-			g_rwDepth[pixelPos] = min(depth, depthMin);
-	}
+#if USE_MUTEX > 1
+		// Mutual exclusive writing
+		[allow_uav_condition]
+		for (i = 0, depthMin = 0xffffffff; i < 0xffffffff && depthMin == 0xffffffff; ++i)
+		{
+			InterlockedExchange(g_rwDepth[pixelPos], 0xffffffff, depthMin);
+			if (depthMin != 0xffffffff)
+				// Critical section
+				g_rwDepth[pixelPos] = min(depth, depthMin);
+		}
 #else
-	InterlockedMin(g_rwDepth[pixelPos], depth, depthMin);
+		InterlockedMin(g_rwDepth[pixelPos], depth, depthMin);
 #endif
-	if (depth > depthMin) return;
+		return DepthTest(depth, depthMin);
+	}
 
-	// Interpolations
-	float3 persp = float3(w.x * primVPos[0].w, w.y * primVPos[1].w, w.z * primVPos[2].w);
-	input.Pos.w = 1.0 / (persp.x + persp.y + persp.z);
-	persp *= input.Pos.w;
-	
-#include "SetAttributes.hlsli"
+	// Early test, a locked pixel is resolved in the critical section
+	DeviceMemoryBarrier();
+	depthMin = g_rwDepth[pixelPos];
 
-	// Call pixel shader
-#ifndef CR_OUT_STRUCT_TYPE
-#define CR_OUT_STRUCT_TYPE CR_TARGET_TYPE0
-#endif
-	CR_OUT_STRUCT_TYPE output = PSMain(input);
+	return depthMin == 0xffffffff || DepthTest(depth, depthMin);
+}
+
+//--------------------------------------------------------------------------------------
+// Depth-tested writes of the shaded fragment.
+//--------------------------------------------------------------------------------------
+void WriteFragment(uint2 pixelPos, uint depth, CR_OUT_STRUCT_TYPE output)
+{
+	// The depth is read-only, e.g., in the equal-test pass after a Z-prepass, so the early
+	// test is final, and only the front-most fragments are shaded without the mutex.
+	if (!g_depthWrite)
+	{
+#include "SetTargets.hlsli"
+		return;
+	}
 
+	uint i, depthMin;
 #if USE_MUTEX
 	// Mutual exclusive writing
 	[allow_uav_condition]
@@ -128,20 +89,97 @@ void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx :
 		if (depthMin != 0xffffffff)
 		{
 			// Critical section
-			if (depth <= depthMin)
+			const bool isPassed = DepthTest(depth, depthMin);
+			if (isPassed)
 			{
 				//g_rwRenderTarget[pixelPos] = float4(w, 1.0);
 #include "SetTargets.hlsli"
 			}
-			g_rwDepth[pixelPos] = min(depth, depthMin);
+			g_rwDepth[pixelPos] = isPassed && g_depthWrite ? depth : depthMin;
 		}
 	}
 #else
 	// This path is not fully watertight, but is faster and works in most cases
 	DeviceMemoryBarrier();
-	if (depth == g_rwDepth[pixelPos])
+	depthMin = g_rwDepth[pixelPos];
+	if (IsDepthOrdered() ? depth == depthMin : DepthTest(depth, depthMin))
 	{
+		if (g_depthWrite) g_rwDepth[pixelPos] = depth;
 #include "SetTargets.hlsli"
 	}
 #endif
 }
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID, uint GTidx : SV_GroupIndex)
+{
+	const TilePrim tilePrim = g_roTilePrimitives[Gid];
+	const uint2 tile = uint2(tilePrim.TileIdx % g_tileDim.x, tilePrim.TileIdx / g_tileDim.x);
+
+	// Load the vertex positions of the triangle
+	const float3x4 primVPos = LoadPrimitive(tilePrim.PrimId);
+
+	PSIn input;
+	float3 w;
+	uint depth;
+	const uint2 pixelPos = (tile << TILE_SIZE_LOG) + GTid;
+
+#if SHADING_RATE
+	// Coarse shading, where the first covered pixel of each coarse pixel calls the pixel shader
+	// for all its covered pixels, and the depth stays per pixel. No thread returns before the
+	// group syncs. The index is in range at the full rate, but unused.
+	const uint rateLog = GetShadingRateLog(tile);
+	const bool isCoarse = rateLog > 0;
+	const uint2 coarsePos = GTid >> max(rateLog, 1);
+	const uint coarseIdx = coarsePos.y * COARSE_TILE_SIZE + coarsePos.x;
+	if (GTidx < COARSE_TILE_SIZE * COARSE_TILE_SIZE) g_shadingLanes[GTidx] = 0xffffffff;
+	GroupMemoryBarrierWithGroupSync();
+
+#if RE_HI_Z
+	const uint zMin = DepthKeyRange(primVPos).x;
+	const bool isVisible = HiZTest(zMin, g_rwHiZ[tile]);
+#else
+	const bool isVisible = true;
+#endif
+	bool isCovered = false;
+	if (isVisible && RasterizePixel(input, w, depth, primVPos, pixelPos, tilePrim.PrimId))
+		isCovered = EarlyDepthTest(pixelPos, depth);
+	if (isCovered && isCoarse) InterlockedMin(g_shadingLanes[coarseIdx], GTidx);
+	GroupMemoryBarrierWithGroupSync();
+
+	CR_OUT_STRUCT_TYPE output = (CR_OUT_STRUCT_TYPE)0;
+	if (isCovered && (!isCoarse || g_shadingLanes[coarseIdx] == GTidx))
+	{
+		// Interpolations
+		Interpolate(input, primVPos, w, tilePrim.PrimId * 3);
+		g_drawId = g_roPrimDrawIds[tilePrim.PrimId];
+
+		// Call pixel shader
+		output = PSMain(input);
+		if (isCoarse) g_shadedOutputs[coarseIdx] = output;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (isCovered)
+	{
+		if (isCoarse) output = g_shadedOutputs[coarseIdx];
+		WriteFragment(pixelPos, depth, output);
+	}
+#else
+#if RE_HI_Z
+	const uint zMin = DepthKeyRange(primVPos).x;
+	if (!HiZTest(zMin, g_rwHiZ[tile])) return;
+#endif
+
+	// Depth test
+	if (!RasterizePixel(input, w, depth, primVPos, pixelPos, tilePrim.PrimId)) return;
+	if (!EarlyDepthTest(pixelPos, depth)) return;
+
+	// Interpolations
+	Interpolate(input, primVPos, w, tilePrim.PrimId * 3);
+	g_drawId = g_roPrimDrawIds[tilePrim.PrimId];
+
+	// Call pixel shader
+	WriteFragment(pixelPos, depth, PSMain(input));
+#endif
+}
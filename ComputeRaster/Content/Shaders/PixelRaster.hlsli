@@ -0,0 +1,125 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+#if !DEPTH_ONLY
+// The draw of the primitive, by which the pixel shader selects its per-draw data
+static uint g_drawId;
+
+#define main PSMain
+#include "PixelShader.hlsl"
+#undef main
+#endif
+#include "Common.hlsli"
+
+#define CR_PRIMITIVE_VERTEX_ATTRIBUTE_TYPE(t, c) t##3x##c
+#define CR_ATTRIBUTE_GEN_TYPE(t, c) t##c
+#define CR_ATTRIBUTE_TYPE(n) CR_ATTRIBUTE_GEN_TYPE(CR_ATTRIBUTE_BASE_TYPE##n, CR_ATTRIBUTE_COMPONENT_COUNT##n)
+
+#define COMPUTE_ATTRIBUTE_float(n) \
+	{ \
+		CR_PRIMITIVE_VERTEX_ATTRIBUTE_TYPE(CR_ATTRIBUTE_BASE_TYPE##n, CR_ATTRIBUTE_COMPONENT_COUNT##n) primVAtt; \
+		[unroll] \
+		for (i = 0; i < 3; ++i) primVAtt[i] = g_roVertexAtt##n[baseVIdx + i]; \
+		input.CR_ATTRIBUTE##n = mul(persp, primVAtt); \
+	}
+
+#define COMPUTE_ATTRIBUTE_min16float(n) COMPUTE_ATTRIBUTE_float(n)
+#define COMPUTE_ATTRIBUTE_int(n) input.CR_ATTRIBUTE##n = g_roVertexAtt##n[baseVIdx]
+#define COMPUTE_ATTRIBUTE_uint(n) COMPUTE_ATTRIBUTE_int(n)
+#define COMPUTE_ATTRIBUTE_min16int(n) COMPUTE_ATTRIBUTE_int(n)
+#define COMPUTE_ATTRIBUTE_min16uint(n) COMPUTE_ATTRIBUTE_int(n)
+#define COMPUTE_ATTRIBUTE_bool(n) COMPUTE_ATTRIBUTE_int(n)
+
+#define COMPUTE_ATTRIBUTE(t, n) COMPUTE_ATTRIBUTE_##t(n)
+#define SET_ATTRIBUTE(n) COMPUTE_ATTRIBUTE(CR_ATTRIBUTE_BASE_TYPE##n, n)
+
+#define DEFINED_ATTRIBUTE(n) (defined(CR_ATTRIBUTE_BASE_TYPE##n) && defined(CR_ATTRIBUTE_COMPONENT_COUNT##n))
+#define DECLARE_ATTRIBUTE(n) Buffer<CR_ATTRIBUTE_TYPE(n)> g_roVertexAtt##n
+
+#define SET_TARGET(n) g_rwRenderTarget##n[pixelPos] = output.CR_TARGET##n
+#define DEFINED_TARGET(n) (defined(CR_TARGET_TYPE##n) && defined(CR_TARGET##n))
+#define DECLARE_TARGET(n) RWTexture2D<CR_TARGET_TYPE##n> g_rwRenderTarget##n
+
+#ifndef CR_OUT_STRUCT_TYPE
+#define CR_OUT_STRUCT_TYPE CR_TARGET_TYPE0
+#endif
+
+// 0: the depth-tested writes race, 1: in the critical sections, 2: also the depth-ordered tests
+#ifndef USE_MUTEX
+#define USE_MUTEX 1
+#endif
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+#if TILED_RASTER
+StructuredBuffer<uint> g_roTileLists;
+StructuredBuffer<uint2> g_roTileListRanges;
+#else
+StructuredBuffer<TilePrim> g_roTilePrimitives;
+#endif
+#if !DEPTH_ONLY
+#include "DeclareAttributes.hlsli"
+StructuredBuffer<uint> g_roPrimDrawIds;	// Last, so the other registers stay the same if g_drawId is unused
+#endif
+#if SHADING_RATE
+Texture2D<uint> g_txShadingRate : register(t0, space1);	// Log2 of the coarse pixel size per tile, apart from the auto-assigned registers
+#endif
+
+//--------------------------------------------------------------------------------------
+// UAV buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<float4> g_rwVertexPos;
+#if !DEPTH_ONLY
+#include "DeclareTargets.hlsli"
+#endif
+
+globallycoherent
+RWTexture2D<uint> g_rwDepth;
+RWTexture2D<uint> g_rwHiZ;
+
+//--------------------------------------------------------------------------------------
+// Load the vertex positions of the triangle in screen space.
+//--------------------------------------------------------------------------------------
+float3x4 LoadPrimitive(uint primId)
+{
+	float3x4 primVPos;
+
+	const uint baseVIdx = primId * 3;
+	[unroll]
+	for (uint i = 0; i < 3; ++i) primVPos[i] = g_rwVertexPos[baseVIdx + i];
+
+	// To screen space.
+	ToScreenSpace(primVPos, GetViewport(primId));
+
+	return primVPos;
+}
+
+#if SHADING_RATE
+//--------------------------------------------------------------------------------------
+// Log2 of the coarse pixel size of the tile, the larger of the draw and the image rates.
+//--------------------------------------------------------------------------------------
+uint GetShadingRateLog(uint2 tile)
+{
+	const uint rateLog = max(g_shadingRateLog, g_hasRateImage ? g_txShadingRate[tile] : 0);
+
+	return min(rateLog, min(TILE_SIZE_LOG, 2));
+}
+#endif
+
+#if !DEPTH_ONLY
+//--------------------------------------------------------------------------------------
+// Perspective-correct interpolations of the vertex attributes.
+//--------------------------------------------------------------------------------------
+void Interpolate(inout PSIn input, float3x4 primVPos, float3 w, uint baseVIdx)
+{
+	float3 persp = float3(w.x * primVPos[0].w, w.y * primVPos[1].w, w.z * primVPos[2].w);
+	input.Pos.w = 1.0 / (persp.x + persp.y + persp.z);
+	persp *= input.Pos.w;
+
+	uint i;
+#include "SetAttributes.hlsli"
+}
+#endif
@@ -0,0 +1,41 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#define DEPTH_ONLY 1
+#include "PixelRaster.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Depth-only pixel raster for shadow maps and Z-prepasses: no attribute interpolations,
+// no pixel shader calls, and no mutex, since only the depth is written.
+//--------------------------------------------------------------------------------------
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)
+{
+	const TilePrim tilePrim = g_roTilePrimitives[Gid];
+	const uint2 tile = uint2(tilePrim.TileIdx % g_tileDim.x, tilePrim.TileIdx / g_tileDim.x);
+
+	// Load the vertex positions of the triangle
+	const float3x4 primVPos = LoadPrimitive(tilePrim.PrimId);
+
+#if RE_HI_Z
+	const uint zMin = DepthKeyRange(primVPos).x;
+	if (!HiZTest(zMin, g_rwHiZ[tile])) return;
+#endif
+
+	float3 w;
+	const uint2 pixelPos = (tile << TILE_SIZE_LOG) + GTid;
+	if (!IsInScissor(pixelPos, GetScissor(GetViewport(tilePrim.PrimId)))) return;
+	if (!Overlap(pixelPos + 0.5, (float3x2)primVPos, w)) return;
+
+	// Normalize barycentric coordinates.
+	const float area = determinant(primVPos[0].xy, primVPos[1].xy, primVPos[2].xy);
+	if (area <= 0.0) return;
+	w /= area;
+
+	// Depth test and write
+	const float z = w.x * primVPos[0].z + w.y * primVPos[1].z + w.z * primVPos[2].z;
+	const uint depth = DepthKey(z);
+	if (IsDepthOrdered()) InterlockedMin(g_rwDepth[pixelPos], depth);
+	else if (g_depthWrite && DepthTest(depth, g_rwDepth[pixelPos])) g_rwDepth[pixelPos] = depth;
+}
@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#define TILED_RASTER 1
+#include "PixelRaster.hlsli"
+
+#define GROUP_SIZE (TILE_SIZE * TILE_SIZE)
+
+#define BLEND_OPAQUE		0
+#define BLEND_ALPHA			1
+#define BLEND_ADDITIVE		2
+#define BLEND_PREMULTIPLIED	3
+
+#if DEFINED_TARGET(0)
+#define CR_OUTPUT0(o) o.CR_TARGET0
+#else
+#define CR_OUTPUT0(o) o
+#endif
+
+groupshared uint g_primIds[GROUP_SIZE];
+groupshared uint g_tileZMax;
+
+//--------------------------------------------------------------------------------------
+// Blend functions of target 0
+//--------------------------------------------------------------------------------------
+float4 Blend(float4 src, float4 dst)
+{
+	switch (g_blendMode)
+	{
+	case BLEND_ALPHA:
+		return float4(lerp(dst.xyz, src.xyz, src.w), src.w + dst.w * (1.0 - src.w));
+	case BLEND_ADDITIVE:
+		return src + dst;
+	case BLEND_PREMULTIPLIED:
+		return src + dst * (1.0 - src.w);
+	default:
+		return src;
+	}
+}
+
+// Targets without alpha can only be blended additively
+float3 Blend(float3 src, float3 dst)
+{
+	return g_blendMode == BLEND_ADDITIVE ? src + dst : src;
+}
+
+float2 Blend(float2 src, float2 dst)
+{
+	return g_blendMode == BLEND_ADDITIVE ? src + dst : src;
+}
+
+float Blend(float src, float dst)
+{
+	return g_blendMode == BLEND_ADDITIVE ? src + dst : src;
+}
+
+//--------------------------------------------------------------------------------------
+// Tile-owner pixel raster: one group owns one tile and walks its sorted primitive list
+// in submission order. Depth and color of each pixel stay on chip until the list is
+// done, so no atomics or mutexes are needed, and the results are ordered, which
+// makes blending deterministic.
+//--------------------------------------------------------------------------------------
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint2 GTid : SV_GroupThreadID, uint2 Gid : SV_GroupID, uint GTidx : SV_GroupIndex)
+{
+	const uint2 range = g_roTileListRanges[g_tileDim.x * Gid.y + Gid.x];
+	if (range.y == 0) return;
+
+	const uint2 pixelPos = (Gid << TILE_SIZE_LOG) + GTid;
+	uint depth = g_rwDepth[pixelPos];
+	bool isWritten = false;
+	CR_OUT_STRUCT_TYPE output = (CR_OUT_STRUCT_TYPE)0;
+	CR_TARGET_TYPE0 dest = 0;
+	if (g_blendMode != BLEND_OPAQUE) dest = g_rwRenderTarget0[pixelPos];
+
+	for (uint n = 0; n < range.y; n += GROUP_SIZE)
+	{
+		// Fetch a batch of primitive IDs cooperatively
+		if (n + GTidx < range.y) g_primIds[GTidx] = g_roTileLists[range.x + n + GTidx];
+		GroupMemoryBarrierWithGroupSync();
+
+		const uint batchSize = min(range.y - n, GROUP_SIZE);
+		for (uint k = 0; k < batchSize; ++k)
+		{
+			const uint primId = g_primIds[k];
+			if (!IsInScissor(pixelPos, GetScissor(GetViewport(primId)))) continue;
+
+			// Load the vertex positions of the triangle
+			const float3x4 primVPos = LoadPrimitive(primId);
+
+			PSIn input;
+			float3 w;
+			input.Pos.xy = pixelPos + 0.5;
+			if (!Overlap(input.Pos.xy, (float3x2)primVPos, w)) continue;
+
+			// Normalize barycentric coordinates.
+			const float area = determinant(primVPos[0].xy, primVPos[1].xy, primVPos[2].xy);
+			if (area <= 0.0) continue;
+			w /= area;
+
+			// Depth test
+			input.Pos.z = w.x * primVPos[0].z + w.y * primVPos[1].z + w.z * primVPos[2].z;
+			const uint z = DepthKey(input.Pos.z);
+			if (!DepthTest(z, depth)) continue;
+
+			// Interpolations
+			Interpolate(input, primVPos, w, primId * 3);
+			g_drawId = g_roPrimDrawIds[primId];
+
+			// Call pixel shader
+			output = PSMain(input);
+			if (g_blendMode != BLEND_OPAQUE)
+			{
+				CR_OUTPUT0(output) = (CR_TARGET_TYPE0)Blend(CR_OUTPUT0(output), dest);
+				dest = CR_OUTPUT0(output);
+			}
+			if (g_depthWrite) depth = z;
+			isWritten = true;
+		}
+
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// Write back once
+	if (isWritten)
+	{
+		g_rwDepth[pixelPos] = depth;
+#include "SetTargets.hlsli"
+	}
+
+	// The tile is fully resolved, so its farthest depth is a tighter Hi-Z. The pixels
+	// outside the views keep their depths, and those outside the target read 0.
+	if (GTidx == 0) g_tileZMax = 0;
+	GroupMemoryBarrierWithGroupSync();
+	InterlockedMax(g_tileZMax, depth);
+	GroupMemoryBarrierWithGroupSync();
+	if (GTidx == 0) InterlockedMin(g_rwHiZ[Gid], g_tileZMax);
+}
@@ -0,0 +1,20 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "TileList.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Count the primitives overlapping each tile.
+//--------------------------------------------------------------------------------------
+[numthreads(64, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	const uint numTilePrims = g_rwTilePrimCount[0];
+
+	for (uint i = DTid; i < numTilePrims; i += TILE_LIST_THREAD_COUNT)
+	{
+		const uint tileIdx = g_rwTilePrimitives[i].TileIdx;
+		InterlockedAdd(g_rwTileListRanges[tileIdx].y, 1);
+	}
+}
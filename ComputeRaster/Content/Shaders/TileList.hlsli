@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+#include "Common.hlsli"
+
+#define TILE_LIST_THREAD_COUNT (TILE_LIST_GROUP_COUNT * 64)
+
+//--------------------------------------------------------------------------------------
+// UAV buffers
+// Registers are explicit, since each pass of building the tile lists
+// touches only a part of the shared descriptor table.
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<uint2> g_rwTileListRanges	: register (u0);	// X: offset, Y: count
+RWStructuredBuffer<uint> g_rwTileLists			: register (u1);
+RWStructuredBuffer<uint> g_rwTilePrimCount		: register (u2);
+RWStructuredBuffer<TilePrim> g_rwTilePrimitives	: register (u3);
@@ -11,7 +11,7 @@
 StructuredBuffer<TilePrim> g_roBinPrimitives;
 
 //--------------------------------------------------------------------------------------
-// UAV buffers
+// UAV buffers, the tiles here can also be the bins of the next finer level
 //--------------------------------------------------------------------------------------
 RWStructuredBuffer<float4> g_rwVertexPos;
 RWStructuredBuffer<uint> g_rwTilePrimCount;
@@ -21,9 +21,14 @@ globallycoherent
 RWTexture2D<uint> g_rwTileZ;
 RWTexture2D<uint> g_rwHiZ;
 
-[numthreads(8, 8, 1)]
+[numthreads(1 << TILE_TO_BIN_LOG, 1 << TILE_TO_BIN_LOG, 1)]
 void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx : SV_GroupIndex)
 {
+	// The bin raster drops the entries beyond the capacity, but still counts them
+	uint numEntries, stride;
+	g_roBinPrimitives.GetDimensions(numEntries, stride);
+	if (Gid >= numEntries) return;
+
 	TilePrim tilePrim = g_roBinPrimitives[Gid];
 	const uint2 bin = uint2(tilePrim.TileIdx % g_binDim.x, tilePrim.TileIdx / g_binDim.x);
 
@@ -35,37 +40,43 @@ void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx :
 	for (uint i = 0; i < 3; ++i) primVPos[i] = g_rwVertexPos[baseVIdx + i];
 
 	// To screen space.
-	ToScreenSpace(primVPos);
+	const float4 viewport = GetViewport(tilePrim.PrimId);
+	ToScreenSpace(primVPos, viewport);
 
 #if RE_HI_Z
-	const uint zMin = asuint(min(primVPos[0].z, min(primVPos[1].z, primVPos[2].z)));
-	if (g_rwHiZ[bin] < zMin) return;
+	const uint zMin = DepthKeyRange(primVPos).x;
+	if (!HiZTest(zMin, g_rwHiZ[bin])) return;
 #endif
 
 	// Scale the primitive for conservative rasterization.
 	float3x2 v;
 	[unroll]
-	for (i = 0; i < 3; ++i) v[i] = primVPos[i].xy / TILE_SIZE;
+	for (i = 0; i < 3; ++i) v[i] = primVPos[i].xy / (1 << g_refineSizeLog);
 	float3x2 sv = Scale(v, 0.5);
 
 	float3 w;
 	const uint2 tile = (bin << TILE_TO_BIN_LOG) + GTid;
+	const uint4 scissor = GetScissor(viewport);
+	const uint4 scissorTiles = GetScissorTiles(scissor, g_refineSizeLog);
+	if (any(tile < scissorTiles.xy) || any(tile >= min(scissorTiles.zw, g_tileDim))) return;
+
 	const float2 pos = tile + 0.5;
 	if (!Overlap(pos, sv, w)) return;
 
 #if HI_Z
 	// Depth test
+	const uint2 zRange = DepthKeyRange(primVPos);
 #if !RE_HI_Z
-	const uint zMin = asuint(min(primVPos[0].z, min(primVPos[1].z, primVPos[2].z)));
+	const uint zMin = zRange.x;
 #endif
-	const uint zMax = asuint(max(primVPos[0].z, max(primVPos[1].z, primVPos[2].z)));
+	const uint zMax = zRange.y;
 
 	// Shrink the primitive.
 	const float area = determinant(v[0], v[1], v[2]);
 	sv = Scale(v, -0.5);
 	
 	uint tileZ;
-	if (area >= 2.0 && Overlap(pos, sv, w))
+	if (IsDepthOrdered() && area >= 2.0 && IsTileInScissor(tile, g_refineSizeLog, scissor) && Overlap(pos, sv, w))
 		InterlockedMin(g_rwTileZ[tile], zMax, tileZ);
 	else
 	{
@@ -73,7 +84,7 @@ void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx :
 		tileZ = g_rwTileZ[tile];
 	}
 
-	if (tileZ < zMin) return;
+	if (!HiZTest(zMin, tileZ)) return;
 #endif
 
 	tilePrim.TileIdx = g_tileDim.x * tile.y + tile.x;
@@ -95,5 +106,6 @@ void main(uint2 GTid : SV_GroupThreadID, uint Gid : SV_GroupID)//, uint GTidx :
 #else
 	InterlockedAdd(g_rwTilePrimCount[0], 1, idx);
 #endif
-	g_rwTilePrimitives[idx] = tilePrim;
+	g_rwTilePrimitives.GetDimensions(numEntries, stride);
+	if (idx < numEntries) g_rwTilePrimitives[idx] = tilePrim;
 }
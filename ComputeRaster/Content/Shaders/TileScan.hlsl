@@ -0,0 +1,41 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "TileList.hlsli"
+
+#define GROUP_SIZE 1024
+
+groupshared uint g_scan[GROUP_SIZE];
+
+//--------------------------------------------------------------------------------------
+// Exclusive prefix sum of the per-tile primitive counts to get the list offsets.
+// One group walks over all tiles chunk by chunk, carrying the running total.
+//--------------------------------------------------------------------------------------
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint GTid : SV_GroupThreadID)
+{
+	const uint numTiles = g_tileDim.x * g_tileDim.y;
+
+	uint carry = 0;
+	for (uint n = 0; n < numTiles; n += GROUP_SIZE)
+	{
+		const uint tileIdx = n + GTid;
+		const uint count = tileIdx < numTiles ? g_rwTileListRanges[tileIdx].y : 0;
+		g_scan[GTid] = count;
+		GroupMemoryBarrierWithGroupSync();
+
+		// Inclusive scan in groupshared memory
+		for (uint s = 1; s < GROUP_SIZE; s <<= 1)
+		{
+			const uint value = GTid >= s ? g_scan[GTid - s] : 0;
+			GroupMemoryBarrierWithGroupSync();
+			g_scan[GTid] += value;
+			GroupMemoryBarrierWithGroupSync();
+		}
+
+		if (tileIdx < numTiles) g_rwTileListRanges[tileIdx].x = carry + g_scan[GTid] - count;
+		carry += g_scan[GROUP_SIZE - 1];
+		GroupMemoryBarrierWithGroupSync();
+	}
+}
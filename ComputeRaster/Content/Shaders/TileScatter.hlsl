@@ -0,0 +1,24 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "TileList.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Scatter the primitive IDs into the per-tile lists.
+// After this pass, the offset of each range points to the end of its list.
+//--------------------------------------------------------------------------------------
+[numthreads(64, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	const uint numTilePrims = g_rwTilePrimCount[0];
+
+	for (uint i = DTid; i < numTilePrims; i += TILE_LIST_THREAD_COUNT)
+	{
+		const TilePrim tilePrim = g_rwTilePrimitives[i];
+
+		uint idx;
+		InterlockedAdd(g_rwTileListRanges[tilePrim.TileIdx].x, 1, idx);
+		g_rwTileLists[idx] = tilePrim.PrimId;
+	}
+}
@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "TileList.hlsli"
+
+#define GROUP_SIZE		64
+#define LDS_SORT_SIZE	1024
+
+groupshared uint g_keys[LDS_SORT_SIZE];
+
+//--------------------------------------------------------------------------------------
+// Key accessors, the lists fitting in groupshared memory are sorted there.
+//--------------------------------------------------------------------------------------
+uint LoadKey(uint i, uint baseIdx, bool useLds)
+{
+	return useLds ? g_keys[i] : g_rwTileLists[baseIdx + i];
+}
+
+void StoreKey(uint i, uint key, uint baseIdx, bool useLds)
+{
+	if (useLds) g_keys[i] = key;
+	else g_rwTileLists[baseIdx + i] = key;
+}
+
+void Sync(bool useLds)
+{
+	if (useLds) GroupMemoryBarrierWithGroupSync();
+	else DeviceMemoryBarrierWithGroupSync();
+}
+
+//--------------------------------------------------------------------------------------
+// Sort the primitive list of a tile by primitive ID (submission order).
+// Bitonic sort whose comparators all point the same way, so that a non-power-
+// of-two list behaves as if padded with +inf and the padding is never touched.
+//--------------------------------------------------------------------------------------
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint GTid : SV_GroupThreadID, uint2 Gid : SV_GroupID)
+{
+	const uint tileIdx = g_tileDim.x * Gid.y + Gid.x;
+	const uint2 range = g_rwTileListRanges[tileIdx];
+	const uint count = range.y;
+	const uint baseIdx = range.x - count;	// Offset points to the end of the list after scattering
+	if (count < 2)
+	{
+		if (GTid == 0) g_rwTileListRanges[tileIdx].x = baseIdx;
+		return;
+	}
+
+	const bool useLds = count <= LDS_SORT_SIZE;
+	uint i;
+	if (useLds)
+	{
+		for (i = GTid; i < count; i += GROUP_SIZE) g_keys[i] = g_rwTileLists[baseIdx + i];
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	uint size = 2;
+	while (size < count) size <<= 1;
+	const uint numPairs = size >> 1;
+
+	for (uint k = 2; k <= size; k <<= 1)
+	{
+		for (uint j = k >> 1; j > 0; j >>= 1)
+		{
+			for (i = GTid; i < numPairs; i += GROUP_SIZE)
+			{
+				const uint a = (i / j) * (j << 1) + (i % j);
+				const uint b = j == (k >> 1) ? a ^ (k - 1) : a + j;
+				if (b < count)
+				{
+					const uint keyA = LoadKey(a, baseIdx, useLds);
+					const uint keyB = LoadKey(b, baseIdx, useLds);
+					if (keyA > keyB)
+					{
+						StoreKey(a, keyB, baseIdx, useLds);
+						StoreKey(b, keyA, baseIdx, useLds);
+					}
+				}
+			}
+			Sync(useLds);
+		}
+	}
+
+	if (useLds)
+		for (i = GTid; i < count; i += GROUP_SIZE) g_rwTileLists[baseIdx + i] = g_keys[i];
+
+	// Restore the offset to the beginning of the list
+	if (GTid == 0) g_rwTileListRanges[tileIdx].x = baseIdx;
+}
@@ -7,7 +7,7 @@
 //--------------------------------------------------------------------------------------
 // Fetch shader
 //--------------------------------------------------------------------------------------
-void FetchShader(uint id, out VSIn result)
+void FetchShader(uint id, int baseVertex, out VSIn result)
 {
 	result = g_roVertexBuffer[id];
 }
@@ -2,6 +2,16 @@
 // Copyright (c) XU, Tianchen. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#include "SharedConst.h"
+
+// The draw and the instance of the vertex, and the view that it is broadcast to, by which
+// the vertex shader selects its per-draw and per-instance transforms and view matrices,
+// where the per-instance data of the draw start at g_baseInstance
+static uint g_drawId;
+static uint g_baseInstance;
+static uint g_instanceId;
+static uint g_viewId;
+
 #define main VSMain
 #include "VertexShader.hlsl"
 #undef main
@@ -9,41 +19,107 @@
 #define CR_ATTRIBUTE_GEN_TYPE(t, c) t##c
 #define CR_ATTRIBUTE_TYPE(n) CR_ATTRIBUTE_GEN_TYPE(CR_ATTRIBUTE_BASE_TYPE##n, CR_ATTRIBUTE_COMPONENT_COUNT##n)
 
-#define SET_ATTRIBUTE(n) g_rwVertexAtt##n[DTid] = output.CR_ATTRIBUTE##n
+#define SET_ATTRIBUTE(n) g_rwVertexAtt##n[idx] = output.CR_ATTRIBUTE##n
 
 #define DEFINED_ATTRIBUTE(n) (defined(CR_ATTRIBUTE_BASE_TYPE##n) && defined(CR_ATTRIBUTE_COMPONENT_COUNT##n))
 #define DECLARE_ATTRIBUTE(n) RWBuffer<CR_ATTRIBUTE_TYPE(n)> g_rwVertexAtt##n
 
+//--------------------------------------------------------------------------------------
+// Structure
+//--------------------------------------------------------------------------------------
+struct DrawRecord
+{
+	uint NumVertices;	// Per instance
+	uint NumInstances;
+	uint StartVertex;	// Start index of the indexed draws
+	int BaseVertex;
+	uint BaseInstance;
+	uint VertexOffset;	// Of the outputs in a view
+	uint DrawId;	// Of the per-draw data, which the GPU culling keeps through the compaction
+};
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbDraws
+{
+	uint g_numViewVertices;	// Of all the draws, where the outputs of each view are consecutive
+	uint g_numDraws;	// Set by the indirect arguments after the GPU culling
+	uint g_baseRecord;
+	uint g_numViews;
+};
+
 //--------------------------------------------------------------------------------------
 // Buffers
 //--------------------------------------------------------------------------------------
 StructuredBuffer<VSIn> g_roVertexBuffer;
+StructuredBuffer<DrawRecord> g_roDrawRecords;
 Buffer<uint> g_roIndexBuffer;
 
 //--------------------------------------------------------------------------------------
 // UAV buffers
 //--------------------------------------------------------------------------------------
 RWStructuredBuffer<float4> g_rwVertexPos;
+RWStructuredBuffer<uint> g_rwPrimDrawIds;
 #include "DeclareAttributes.hlsli"
 
 //--------------------------------------------------------------------------------------
 // Fetch shader
 //--------------------------------------------------------------------------------------
-void FetchShader(uint id, out VSIn result);
+void FetchShader(uint id, int baseVertex, out VSIn result);
+
+//--------------------------------------------------------------------------------------
+// Find the draw of an output vertex, which is the last one starting at or before it,
+// so the empty draws are skipped.
+//--------------------------------------------------------------------------------------
+uint FindDraw(uint vertexId)
+{
+	uint first = 0, last = g_numDraws - 1;
+	while (first < last)
+	{
+		const uint mid = (first + last + 1) >> 1;
+		if (g_roDrawRecords[g_baseRecord + mid].VertexOffset <= vertexId) first = mid;
+		else last = mid - 1;
+	}
+
+	return first;
+}
 
 //--------------------------------------------------------------------------------------
 // Vertex shader stage process
 //--------------------------------------------------------------------------------------
 [numthreads(64, 1, 1)]
-void main(uint DTid : SV_DispatchThreadID)
+void main(uint2 DTid : SV_DispatchThreadID)
 {
+	// The groups are dispatched in rows of VERTEX_GROUP_ROW
+	const uint id = 64 * VERTEX_GROUP_ROW * DTid.y + DTid.x;
+	if (id >= g_numViewVertices) return;
+
+	const DrawRecord draw = g_roDrawRecords[g_baseRecord + FindDraw(id)];
+	const uint vertexId = id - draw.VertexOffset;
+	g_drawId = draw.DrawId;
+	g_baseInstance = draw.BaseInstance;
+	g_instanceId = vertexId / draw.NumVertices;
+
+	// The indirect dispatch rounds up the vertices of the draws after the GPU culling
+	if (g_instanceId >= draw.NumInstances) return;
+
 	VSIn input;
-	FetchShader(DTid, input);
+	FetchShader(draw.StartVertex + vertexId % draw.NumVertices, draw.BaseVertex, input);
+
+	// The vertex is fetched once per instance, and broadcast to all the views, where the
+	// outputs are ordered by view, draw, instance, and vertex
+	for (g_viewId = 0; g_viewId < g_numViews; ++g_viewId)
+	{
+		// Call vertex shader
+		VSOut output = VSMain(input);
 
-	// Call vertex shader
-	VSOut output = VSMain(input);
+		const uint idx = g_numViewVertices * g_viewId + id;
+		g_rwVertexPos[idx] = output.Pos;
 
-	g_rwVertexPos[DTid] = output.Pos;
+		// The pixel shaders look up the draw per primitive
+		if (vertexId % 3 == 0) g_rwPrimDrawIds[idx / 3] = g_drawId;
 
 #include "SetAttributes.hlsli"
+	}
 }
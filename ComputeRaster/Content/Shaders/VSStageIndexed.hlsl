@@ -7,8 +7,8 @@
 //--------------------------------------------------------------------------------------
 // Fetch shader
 //--------------------------------------------------------------------------------------
-void FetchShader(uint id, out VSIn result)
+void FetchShader(uint id, int baseVertex, out VSIn result)
 {
-	const uint index = g_roIndexBuffer[id];
+	const uint index = g_roIndexBuffer[id] + baseVertex;
 	result = g_roVertexBuffer[index];
 }
@@ -0,0 +1,6 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// Built without the attribute definitions, so only the positions are written
+#include "VSStageIndexed.hlsl"
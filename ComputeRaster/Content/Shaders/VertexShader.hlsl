@@ -23,6 +23,8 @@ cbuffer cb
 	matrix g_normal;
 };
 
+StructuredBuffer<float3> g_roInstanceOffsets;	// Object-space offsets of the instances
+
 //--------------------------------------------------------------------------------------
 // Vertex shader
 //--------------------------------------------------------------------------------------
@@ -30,7 +32,7 @@ VSOut main(VSIn input)
 {
 	VSOut output;
 
-	output.Pos = float4(input.Pos, 1.0);
+	output.Pos = float4(input.Pos + g_roInstanceOffsets[g_baseInstance + g_instanceId], 1.0);
 	output.Pos = mul(output.Pos, g_worldViewProj);
 	output.Nrm = mul(input.Nrm, (float3x3)g_normal);
 
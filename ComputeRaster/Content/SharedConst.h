@@ -6,12 +6,46 @@
 
 #define	USE_TRIPPLE_RASTER	1
 
+// Bin levels above the tiles, e.g. 512 -> 64 -> 8 pixels for 4K and 8K targets
+#define MAX_BIN_LEVELS	3
+
+// Minimum entries of the primitive list of a bin level
+#define BIN_PRIMS_MIN	(1 << 16)
+
+// Defaults of the precompiled shaders, the other sizes are runtime permutations
+#ifndef TILE_SIZE_LOG
 #define TILE_SIZE_LOG	3
+#endif
 #define TILE_SIZE		(1 << TILE_SIZE_LOG)
+#ifndef TILE_TO_BIN_LOG
 #define TILE_TO_BIN_LOG	3
+#endif
 #define BIN_SIZE_LOG	(TILE_SIZE_LOG + TILE_TO_BIN_LOG)
 #define BIN_SIZE		(1 << BIN_SIZE_LOG)
 
+#define TILE_LIST_GROUP_COUNT	256
+
+// Groups per row of the vertex stage dispatches, within the limit of 65535 groups per dimension
+#define VERTEX_GROUP_ROW	1024
+
+// Draw records per frame, shared by all the draws and batches
+#define MAX_DRAW_RECORDS	4096
+
+// Objects of an indirect draw culled on the GPU, e.g., the meshlets of all the instances
+#define MAX_DRAW_OBJECTS	65536
+
+#define AREA_HISTOGRAM_SIZE	24
+
+// The first depth pyramid mip within this size is read back for the CPU occlusion queries
+#define PYRAMID_READBACK_SIZE	64
+
+// Comparisons of the depth keys, of which the smaller is the nearer
+#define DEPTH_LESS			0
+#define DEPTH_LESS_EQUAL	1
+#define DEPTH_EQUAL			2
+#define DEPTH_NOT_EQUAL		3
+#define DEPTH_ALWAYS		4
+
 #define CLEAR_COLOR	0.0f, 0.2f, 0.4f
 
 #define	PIDIV4		0.785398163f
@@ -9,14 +9,113 @@ using namespace std;
 using namespace DirectX;
 using namespace XUSG;
 
+// The rejected primitives of the first pass of occlusion culling are live until the re-test pass
+const SoftGraphicsPipeline::TransientInfo SoftGraphicsPipeline::TransientInfos[] =
+{
+	{ sizeof(uint32_t[2]), PHASE_BIN | PHASE_REFINE, (1 << RASTER_UNORDERED) | (1 << RASTER_TILE_ORDERED), L"BinPrimitives" },
+	{ sizeof(uint32_t[2]), PHASE_BIN | PHASE_REFINE, (1 << RASTER_UNORDERED) | (1 << RASTER_TILE_ORDERED), L"BinPrimitives1" },
+	{ sizeof(uint32_t[2]), PHASE_BIN | PHASE_REFINE, (1 << RASTER_UNORDERED) | (1 << RASTER_TILE_ORDERED), L"BinPrimitives2" },
+	{ sizeof(uint32_t), PHASE_TILE_LIST | PHASE_PIXEL, 1 << RASTER_TILE_ORDERED, L"TileLists" },
+	{ sizeof(uint32_t), PHASE_BIN | PHASE_REFINE | PHASE_TILE_LIST | PHASE_PIXEL | PHASE_PYRAMID, 1 << RASTER_UNORDERED, L"RejectedPrimitives" },
+	{ sizeof(uint32_t), PHASE_PYRAMID, (1 << RASTER_UNORDERED) | (1 << RASTER_TILE_ORDERED), L"DepthPyramidMip" }
+};
+static_assert(MAX_BIN_LEVELS == 3, "TransientInfos lists a bin primitive buffer per bin level");
+
+// The stages of the non-default tile sizes or features are the permutations
+const SoftGraphicsPipeline::StageInfo SoftGraphicsPipeline::StageInfos[] =
+{
+	{ L"VSStage", L"VertexShaderStage", 0, false, false },
+	{ L"VSStageIndexed", L"VertexShaderStageIndexed", 0, false, false },
+	{ L"VSStageDepth", L"VertexShaderStageDepth", 0, false, false },
+	{ L"VSStageIndexedDepth", L"VertexShaderStageIndexedDepth", 0, false, false },
+	{ L"BinRaster", L"BinRaster", FEATURE_HI_Z, true, false },
+	{ L"TileRaster", L"TileRaster", FEATURE_HI_Z | FEATURE_RE_HI_Z, true, false },
+	{ L"PixelRaster", L"PixelRaster", FEATURE_RE_HI_Z | FEATURE_MUTEX | FEATURE_MUTEX_DEPTH_ORDERED | FEATURE_VRS, true, true },
+	{ L"PixelRasterDepth", L"PixelRasterDepth", FEATURE_RE_HI_Z, true, false },
+	{ L"TileCount", L"TileCount", 0, false, false },
+	{ L"TileScan", L"TileScan", 0, false, false },
+	{ L"TileScatter", L"TileScatter", 0, false, false },
+	{ L"TileSort", L"TileSort", 0, false, false },
+	{ L"PixelRasterTiled", L"PixelRasterTiled", 0, true, true },
+	{ L"DepthPyramid", L"DepthPyramid", 0, false, false },
+	{ L"DrawCull", L"DrawCull", 0, false, false }
+};
+
+static const wchar_t* const g_pipelineCacheDir = L"PipelineCache";
+static const wchar_t* const g_permutationLibDir = L"Permutations";
+
+#if defined(_DEBUG)
+// Whether the edge pixel of a size, e.g., 720, is covered at each mip by the texel that the
+// occlusion queries clamp onto, given the reads of the last texels in DepthPyramid.hlsl
+static bool isPyramidEdgeCovered(uint32_t size, uint32_t numMips)
+{
+	auto srcDim = size;
+	auto coverEnd = size;	// Of the pixels covered by the last texel of the source mip
+	for (auto i = 0u; i < numMips; ++i)
+	{
+		const auto dim = i > 0 ? (max)(srcDim >> 1, 1u) : XUSG_DIV_UP(size, 2);
+		const auto lastRead = (max)(srcDim - 1, 2 * (dim - 1) + 1);
+		if (lastRead < srcDim - 1) coverEnd = (lastRead + 1) << i;
+
+		const auto texel = (min)((size - 1) >> (i + 1), dim - 1);
+		if (texel == dim - 1 && coverEnd < size) return false;
+		srcDim = dim;
+	}
+
+	return true;
+}
+#endif
+
 SoftGraphicsPipeline::SoftGraphicsPipeline() :
 	m_pColorTarget(nullptr),
 	m_pDepth(nullptr),
+	m_pRateImage(nullptr),
 	m_vertexCompletions(nullptr),
+	m_transients(),
+	m_transientSizes(),
+	m_transientSlots(),
+	m_pyramidReadbacks(),
+	m_pyramidCacheInfo(),
+	m_pDrawRecords(nullptr),
+	m_scissorRect(0, 0, LONG_MAX, LONG_MAX),
 	m_maxVertexCount(0),
-	m_clearDepth(0xffffffff)
+	m_numDrawRecords(0),
+	m_numViews(1),
+	m_viewColumns(1),
+	m_numOutTables(0),
+	m_numClears(0),
+	m_numDirtyRects(0),
+	m_clearDepth(0xffffffff),
+	m_depthFlip(0),
+	m_maxTileCount(0),
+	m_vsDataHash(0),
+	m_vertexHash(0),
+	m_frameVertexHash(0),
+	m_drawHash(0),
+	m_lastDrawHash(0),
+	m_tableCacheClock(0),
+	m_tileSizeLog(TILE_SIZE_LOG),
+	m_tileToBinLog(TILE_TO_BIN_LOG),
+	m_numBinLevels(USE_TRIPPLE_RASTER),
+	m_features(DefaultFeatures),
+	m_isPipelineDirty(true),
+	m_isCompiled(false),
+	m_isCompileFailed(false),
+	m_hasVertexAttribs(false),
+	m_isDrawResident(false),
+	m_isLastDrawResident(false),
+	m_isTableDirty(true),
+	m_isHistogramDirty(true),
+	m_frameIndex(0),
+	m_binThreshold(0.0f),
+	m_occlusionCulling(false),
+	m_depthWrite(true),
+	m_rasterMode(RASTER_UNORDERED),
+	m_blendMode(BLEND_OPAQUE),
+	m_shadingRate(SHADING_RATE_1X1),
+	m_depthFunc(ComparisonFunc::LESS_EQUAL)
 {
-	m_shaderLib = ShaderLib::MakeUnique();
+	assignTransients();
 }
 
 SoftGraphicsPipeline::~SoftGraphicsPipeline()
@@ -26,12 +125,13 @@ SoftGraphicsPipeline::~SoftGraphicsPipeline()
 bool SoftGraphicsPipeline::Init(CommandList* pCommandList, vector<Resource::uptr>& uploaders)
 {
 	const auto pDevice = pCommandList->GetDevice();
-	m_computePipelineLib = Compute::PipelineLib::MakeUnique(pDevice);
+	// A pipeline lib per worker of Compile(), as the libs are not thread-safe
+	m_computePipelineLibs.resize((min)((max)(thread::hardware_concurrency(), 1u), static_cast<uint32_t>(NUM_STAGE)));
+	for (auto& pipelineLib : m_computePipelineLibs) pipelineLib = Compute::PipelineLib::MakeUnique(pDevice);
 	m_descriptorTableLib = DescriptorTableLib::MakeUnique(pDevice);
 	m_pipelineLayoutLib = PipelineLayoutLib::MakeUnique(pDevice);
 
 	const uint32_t tileBufferSize = (UINT32_MAX >> 8) + 1;
-	const uint32_t binBufferSize = tileBufferSize >> 6;
 
 	// Create buffers
 	m_tilePrimCount = StructuredBuffer::MakeUnique();
@@ -44,19 +144,89 @@ bool SoftGraphicsPipeline::Init(CommandList* pCommandList, vector<Resource::uptr
 		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT, 1,
 		nullptr, 1, nullptr, MemoryFlag::NONE, L"TilePrimitives"), false);
 
-	m_binPrimCount = StructuredBuffer::MakeUnique();
-	XUSG_N_RETURN(m_binPrimCount->Create(pDevice, 3, sizeof(uint32_t),
+	for (uint8_t i = 0; i < MAX_BIN_LEVELS; ++i)
+	{
+		// Each coarser level holds about 64x fewer entries, but at least BIN_PRIMS_MIN, as the
+		// few bins of the coarse levels each take many large primitives. The bin raster drops
+		// the entries beyond.
+		const auto binBufferSize = (max)(tileBufferSize >> (6 * (i + 1)), static_cast<uint32_t>(BIN_PRIMS_MIN));
+		const auto level = i > 0 ? to_wstring(i) : wstring();
+
+		m_binPrimCounts[i] = StructuredBuffer::MakeUnique();
+		XUSG_N_RETURN(m_binPrimCounts[i]->Create(pDevice, 3, sizeof(uint32_t),
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+			1, nullptr, 1, nullptr, MemoryFlag::NONE, (L"BinPrimitiveCount" + level).c_str()), false);
+
+		XUSG_N_RETURN(createTransient(pDevice, static_cast<TransientBuffer>(TRANSIENT_BIN_PRIMS + i), binBufferSize), false);
+	}
+
+	m_areaHistogram = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_areaHistogram->Create(pDevice, AREA_HISTOGRAM_SIZE, sizeof(uint32_t),
 		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
-		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"BinPrimitiveCount"), false);
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"AreaHistogram"), false);
 
-	m_binPrimitives = StructuredBuffer::MakeUnique();
-	XUSG_N_RETURN(m_binPrimitives->Create(pDevice, binBufferSize, sizeof(uint32_t[2]),
-		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT, 1,
-		nullptr, 1, nullptr, MemoryFlag::NONE, L"BinPrimitives"), false);
+	m_areaHistogramReadback = Buffer::MakeUnique();
+	XUSG_N_RETURN(m_areaHistogramReadback->Create(pDevice, sizeof(uint32_t[AREA_HISTOGRAM_SIZE]) * FrameCount,
+		ResourceFlag::DENY_SHADER_RESOURCE, MemoryType::READBACK, 0, nullptr, 0, nullptr,
+		MemoryFlag::NONE, L"AreaHistogramReadback"), false);
+
+	m_rejectedCount = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_rejectedCount->Create(pDevice, 1, sizeof(uint32_t),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"RejectedPrimitiveCount"), false);
+
+	m_rejectedArgs = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_rejectedArgs->Create(pDevice, 3, sizeof(uint32_t),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"RejectedPrimitiveArgs"), false);
+
+	const auto pyramidMipSize = sizeof(uint32_t[PYRAMID_READBACK_SIZE * PYRAMID_READBACK_SIZE]);
+	XUSG_N_RETURN(createTransient(pDevice, TRANSIENT_PYRAMID_MIP, PYRAMID_READBACK_SIZE * PYRAMID_READBACK_SIZE), false);
+
+	m_pyramidReadback = Buffer::MakeUnique();
+	XUSG_N_RETURN(m_pyramidReadback->Create(pDevice, pyramidMipSize * FrameCount,
+		ResourceFlag::DENY_SHADER_RESOURCE, MemoryType::READBACK, 0, nullptr, 0, nullptr,
+		MemoryFlag::NONE, L"DepthPyramidReadback"), false);
+
+	// Draw records of the frames in flight, written by the CPU each draw
+	m_drawRecords = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_drawRecords->Create(pDevice, MAX_DRAW_RECORDS * FrameCount, sizeof(DrawRecord),
+		ResourceFlag::NONE, MemoryType::UPLOAD, 1, nullptr, 0, nullptr,
+		MemoryFlag::NONE, L"DrawRecords"), false);
+	m_pDrawRecords = static_cast<DrawRecord*>(m_drawRecords->Map());
+	m_barriers.resize(m_vertexAttribs.size() + 2 * MAX_BIN_LEVELS + 8);
+	m_accesses.resize(m_barriers.size());
+	m_uavAccesses.reserve(m_vertexAttribs.size() + 4 * MAX_BIN_LEVELS + 16);
+
+	// Draw records of the visible objects, compacted by the GPU culling
+	m_culledRecords = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_culledRecords->Create(pDevice, MAX_DRAW_OBJECTS, sizeof(DrawRecord),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"CulledDrawRecords"), false);
+
+	m_drawArgs = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_drawArgs->Create(pDevice, 8, sizeof(uint32_t),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"DrawArguments"), false);
+
+	m_rejectedObjects = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_rejectedObjects->Create(pDevice, MAX_DRAW_OBJECTS + 1, sizeof(uint32_t),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"RejectedObjects"), false);
 
 	// create reset buffer for resetting TilePrimitiveCount
 	XUSG_N_RETURN(createResetBuffer(pCommandList, uploaders), false);
 
+	// The coarse pixel raster always reads a rate image, which is a 1x1 one without any
+	m_defaultRateImage = Texture2D::MakeUnique();
+	XUSG_N_RETURN(m_defaultRateImage->Create(pDevice, 1, 1, Format::R8_UINT, 1, ResourceFlag::NONE,
+		1, 1, false, MemoryFlag::NONE, L"DefaultShadingRate"), false);
+	const uint8_t defaultRate = SHADING_RATE_1X1;
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_defaultRateImage->Upload(pCommandList, uploaders.back().get(), &defaultRate,
+		sizeof(uint8_t), ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+	m_rateTable = getCachedTable(1, &m_defaultRateImage->GetSRV());
+
 	// create command layout
 	XUSG_N_RETURN(createCommandLayout(pDevice), false);
 
@@ -64,25 +234,37 @@ bool SoftGraphicsPipeline::Init(CommandList* pCommandList, vector<Resource::uptr
 }
 
 bool SoftGraphicsPipeline::CreateVertexShaderLayout(Util::PipelineLayout* pPipelineLayout,
-	uint32_t slotCount, int32_t srvBindingMax, int32_t uavBindingMax)
+	uint32_t slotCount, int32_t srvBindingMax, int32_t uavBindingMax, int32_t cbvBindingMax)
 {
 	m_extVsTables.resize(slotCount);
-	const auto numUAVs = static_cast<uint32_t>(m_vertexAttribs.size()) + 1;
+	m_vsCommandLayout.reset();	// The indirect draw count refers to the root constants of this layout
+	const auto numUAVs = static_cast<uint32_t>(m_vertexAttribs.size()) + 2;
 	//auto pPipelineLayoutIndexed = pPipelineLayout;
 
 	// Create pipeline layouts
 	{
-		pPipelineLayout->SetRange(slotCount, DescriptorType::SRV, 2,
+		pPipelineLayout->SetRange(slotCount, DescriptorType::SRV, 3,
 			srvBindingMax + 1, 0, DescriptorFlag::DESCRIPTORS_VOLATILE);
 		pPipelineLayout->SetRange(slotCount + 1, DescriptorType::UAV, numUAVs,
 			uavBindingMax + 1, 0, DescriptorFlag::DESCRIPTORS_VOLATILE |
 			DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pPipelineLayout->SetConstants(slotCount + 2, 4, cbvBindingMax + 1);
 		XUSG_X_RETURN(m_pipelineLayouts[VERTEX_PROCESS], pPipelineLayout->GetPipelineLayout(
 			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"VertexShaderStageLayout"), false);
+		m_layoutKeys[VERTEX_PROCESS] = pPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 	}
 
 	m_pipelineLayouts[VERTEX_INDEXED] = m_pipelineLayouts[VERTEX_PROCESS];
 
+	// The depth-only variants write the positions only
+	m_pipelineLayouts[VERTEX_DEPTH] = m_pipelineLayouts[VERTEX_PROCESS];
+	m_pipelineLayouts[VERTEX_INDEXED_DEPTH] = m_pipelineLayouts[VERTEX_PROCESS];
+	m_layoutKeys[VERTEX_INDEXED] = m_layoutKeys[VERTEX_PROCESS];
+	m_layoutKeys[VERTEX_DEPTH] = m_layoutKeys[VERTEX_PROCESS];
+	m_layoutKeys[VERTEX_INDEXED_DEPTH] = m_layoutKeys[VERTEX_PROCESS];
+	m_isCompiled = false;
+	m_isCompileFailed = false;
+
 	return true;
 }
 
@@ -92,19 +274,70 @@ bool SoftGraphicsPipeline::CreatePixelShaderLayout(Util::PipelineLayout* pPipeli
 {
 	m_extPsTables.resize(slotCount);
 
+	// The tile-ordered variant shares the external slots
+	const auto numAttribs = static_cast<uint32_t>(m_vertexAttribs.size());
+	const auto tiledPipelineLayout = Util::PipelineLayout::CloneUnique(pPipelineLayout);
+
 	// Create pipeline layouts
 	{
-		const auto numSRVs = static_cast<uint32_t>(m_vertexAttribs.size()) + 1;
+		// Tile primitives, attributes, and draw IDs of the primitives
+		const auto numSRVs = numAttribs + 2;
 		pPipelineLayout->SetConstants(slotCount, XUSG_UINT32_SIZE_OF(CBViewPort), cbvBindingMax + 1);
 		pPipelineLayout->SetRange(slotCount + 1, DescriptorType::SRV, numSRVs, srvBindingMax + 1);
 		pPipelineLayout->SetRange(slotCount + 2, DescriptorType::UAV, 1, uavBindingMax + 1, 0,
 			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		pPipelineLayout->SetRange(slotCount + 3, DescriptorType::UAV, hasDepth ? numRTs + 2 : numRTs,
 			uavBindingMax + 2, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pPipelineLayout->SetRange(slotCount + 4, DescriptorType::SRV, 1, 0, 1);	// Rate image, in its own space
 		XUSG_X_RETURN(m_pipelineLayouts[PIX_RASTER], pPipelineLayout->GetPipelineLayout(
 			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"PixelRasterLayout"), false);
+		m_layoutKeys[PIX_RASTER] = pPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 	}
 
+	{
+		// Sorted tile lists and tile list ranges instead of the tile primitives
+		const auto numSRVs = numAttribs + 3;
+		tiledPipelineLayout->SetConstants(slotCount, XUSG_UINT32_SIZE_OF(CBViewPort), cbvBindingMax + 1);
+		tiledPipelineLayout->SetRange(slotCount + 1, DescriptorType::SRV, numSRVs, srvBindingMax + 1);
+		tiledPipelineLayout->SetRange(slotCount + 2, DescriptorType::UAV, 1, uavBindingMax + 1, 0,
+			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		tiledPipelineLayout->SetRange(slotCount + 3, DescriptorType::UAV, hasDepth ? numRTs + 2 : numRTs,
+			uavBindingMax + 2, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		XUSG_X_RETURN(m_pipelineLayouts[PIX_RASTER_TILED], tiledPipelineLayout->GetPipelineLayout(
+			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"PixelRasterTiledLayout"), false);
+		m_layoutKeys[PIX_RASTER_TILED] = tiledPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
+	}
+	m_isCompiled = false;
+	m_isCompileFailed = false;
+
+	return true;
+}
+
+bool SoftGraphicsPipeline::Compile()
+{
+	// The layouts of the external shaders come first
+	assert(m_pipelineLayouts[VERTEX_PROCESS] && m_pipelineLayouts[PIX_RASTER] && m_pipelineLayouts[PIX_RASTER_TILED]);
+	XUSG_N_RETURN(createPipelineLayouts(), false);
+
+	// The stages are strided over the workers, each of which creates
+	// the pipelines in its own pipeline lib
+	CreateDirectoryW(g_pipelineCacheDir, nullptr);
+	CreateDirectoryW(g_permutationLibDir, nullptr);
+	const auto numWorkers = static_cast<uint8_t>(m_computePipelineLibs.size());
+	bool results[NUM_STAGE] = {};
+	vector<thread> workers;
+	workers.reserve(numWorkers);
+	for (uint8_t w = 0; w < numWorkers; ++w)
+		workers.emplace_back([this, &results, numWorkers, w]()
+		{
+			for (auto i = w; i < NUM_STAGE; i += numWorkers)
+				results[i] = createPipeline(static_cast<StageIndex>(i), m_computePipelineLibs[w].get());
+		});
+	for (auto& worker : workers) worker.join();
+
+	for (const auto& result : results) XUSG_N_RETURN(result, false);
+	m_isCompiled = true;
+
 	return true;
 }
 
@@ -126,6 +359,10 @@ void SoftGraphicsPipeline::SetAttribute(uint32_t i, uint32_t stride, Format form
 	if (i >= m_vertexAttribs.size()) m_vertexAttribs.resize(i + 1);
 	if (i >= m_attribInfo.size()) m_attribInfo.resize(i + 1);
 
+	m_barriers.resize(m_vertexAttribs.size() + 2 * MAX_BIN_LEVELS + 8);
+	m_accesses.resize(m_barriers.size());
+	m_uavAccesses.reserve(m_vertexAttribs.size() + 4 * MAX_BIN_LEVELS + 16);
+
 	m_attribInfo[i].Stride = stride;
 	m_attribInfo[i].Format = format;
 	m_attribInfo[i].Name = name;
@@ -147,39 +384,179 @@ void SoftGraphicsPipeline::SetRenderTargets(uint32_t numRTs, Texture2D* pColorTa
 	m_pDepth = pDepth;
 	m_numColorTargets = numRTs;
 
-	m_outTables.resize(pDepth ? numRTs + 3 : numRTs);
+	assert(numRTs <= MaxColorTargets);
+	m_numOutTables = pDepth ? numRTs + 2 + MAX_BIN_LEVELS : numRTs;
 	for (auto i = 0u; i < numRTs; ++i)
+		m_outTables[i] = getCachedTable(1, &pColorTarget->GetUAV());
+
+	if (pDepth)
 	{
-		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
-		descriptorTable->SetDescriptors(0, 1, &pColorTarget->GetUAV());
-		m_outTables[i] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
+		m_outTables[m_numOutTables - 1] = getCachedTable(1, &pDepth->PixelZ->GetUAV());
+		m_outTables[m_numOutTables - 2] = getCachedTable(1, &pDepth->TileZ->GetUAV());
+		for (uint8_t i = 0; i < MAX_BIN_LEVELS; ++i)
+			m_outTables[m_numOutTables - 3 - i] = getCachedTable(1, &pDepth->BinZ[i]->GetUAV());
 	}
+}
 
-	if (pDepth)
+void SoftGraphicsPipeline::SetViewport(const Viewport& viewport)
+{
+	m_viewport = viewport;
+}
+
+void SoftGraphicsPipeline::SetScissorRect(const RectRange& rect)
+{
+	m_scissorRect = rect;
+}
+
+void SoftGraphicsPipeline::SetDirtyRects(uint32_t numRects, const RectRange* pRects)
+{
+	// The overlapping rectangles are merged into their bounds, so that no pixel is cleared
+	// and rasterized twice, e.g., blended twice by the tile-ordered raster
+	assert(numRects <= MaxDirtyRects);
+	numRects = (min)(numRects, static_cast<uint32_t>(MaxDirtyRects));
+	m_numDirtyRects = 0;
+	for (auto i = 0u; i < numRects; ++i)
 	{
+		auto rect = pRects[i];
+		for (auto j = 0u; j < m_numDirtyRects;)
 		{
-			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
-			descriptorTable->SetDescriptors(0, 1, &pDepth->PixelZ->GetUAV());
-			m_outTables[m_outTables.size() - 1] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
+			const auto& other = m_dirtyRects[j];
+			if (rect.Left < other.Right && other.Left < rect.Right && rect.Top < other.Bottom && other.Top < rect.Bottom)
+			{
+				// The merged bounds may overlap the rectangles tested before
+				rect.Left = (min)(rect.Left, other.Left);
+				rect.Top = (min)(rect.Top, other.Top);
+				rect.Right = (max)(rect.Right, other.Right);
+				rect.Bottom = (max)(rect.Bottom, other.Bottom);
+				m_dirtyRects[j] = m_dirtyRects[--m_numDirtyRects];
+				j = 0;
+			}
+			else ++j;
 		}
+		m_dirtyRects[m_numDirtyRects++] = rect;
+	}
+}
 
-		{
-			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
-			descriptorTable->SetDescriptors(0, 1, &pDepth->TileZ->GetUAV());
-			m_outTables[m_outTables.size() - 2] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
-		}
+void SoftGraphicsPipeline::SetViews(uint32_t numViews, uint32_t numColumns)
+{
+	m_numViews = (max)(numViews, 1u);
+	m_viewColumns = (min)((max)(numColumns, 1u), m_numViews);
+}
 
-		{
-			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
-			descriptorTable->SetDescriptors(0, 1, &pDepth->BinZ->GetUAV());
-			m_outTables[m_outTables.size() - 3] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
-		}
+void SoftGraphicsPipeline::SetRasterMode(RasterMode mode)
+{
+	m_rasterMode = mode;
+}
+
+void SoftGraphicsPipeline::SetBlendMode(BlendMode mode)
+{
+	m_blendMode = mode;
+}
+
+void SoftGraphicsPipeline::SetShadingRate(ShadingRate rate)
+{
+	m_shadingRate = rate;
+}
+
+void SoftGraphicsPipeline::SetShadingRateImage(Texture2D* pRateImage)
+{
+	m_pRateImage = pRateImage;
+	m_rateTable = getCachedTable(1, &(pRateImage ? pRateImage : m_defaultRateImage.get())->GetSRV());
+}
+
+void SoftGraphicsPipeline::SetTileSizes(uint8_t tileSizeLog, uint8_t tileToBinLog)
+{
+	// A pixel raster group covers a tile, and a tile raster group covers a bin
+	assert(tileSizeLog >= 2 && tileSizeLog <= 5);
+	assert(tileToBinLog >= 2 && tileToBinLog <= 5);
+
+	const auto isChanged = tileSizeLog != m_tileSizeLog || tileToBinLog != m_tileToBinLog;
+	m_isPipelineDirty = m_isPipelineDirty || isChanged;
+	m_isCompiled = m_isCompiled && !m_isPipelineDirty;
+	m_isCompileFailed = m_isCompileFailed && !isChanged;
+	m_tileSizeLog = tileSizeLog;
+	m_tileToBinLog = tileToBinLog;
+}
+
+void SoftGraphicsPipeline::SetFeatures(uint8_t features)
+{
+	m_isCompiled = m_isCompiled && features == m_features;
+	m_isCompileFailed = m_isCompileFailed && features == m_features;
+	m_features = features;
+}
+
+void SoftGraphicsPipeline::SetBinLevels(uint8_t numBinLevels)
+{
+	assert(numBinLevels <= MAX_BIN_LEVELS);
+	m_numBinLevels = numBinLevels;
+}
+
+void SoftGraphicsPipeline::SetOcclusionCulling(bool enable)
+{
+	m_occlusionCulling = enable;
+}
+
+void SoftGraphicsPipeline::SetDepthState(ComparisonFunc func, bool depthWrite)
+{
+	m_depthFunc = func;
+	m_depthWrite = depthWrite;
+
+	// The depth keys flip all the bits but the sign for reverse-Z, so that the smaller is always the nearer
+	switch (func)
+	{
+	case ComparisonFunc::LESS:
+	case ComparisonFunc::LESS_EQUAL:
+		m_depthFlip = 0;
+		break;
+	case ComparisonFunc::GREATER:
+	case ComparisonFunc::GREATER_EQUAL:
+		m_depthFlip = 0x7fffffff;
+		break;
 	}
 }
 
-void SoftGraphicsPipeline::SetViewport(const Viewport& viewport)
+void SoftGraphicsPipeline::SetShaderDefines(uint32_t numDefines, const ShaderDefine* pDefines)
 {
-	m_viewport = viewport;
+	m_shaderDefines.assign(pDefines, pDefines + numDefines);
+}
+
+void SoftGraphicsPipeline::SetFrameIndex(uint8_t frameIndex)
+{
+	m_frameIndex = frameIndex;
+	m_numDrawRecords = 0;
+	m_lastDrawHash = m_drawHash;
+	m_isLastDrawResident = m_isDrawResident;
+	m_drawHash = 0;
+	m_frameVertexHash = 0;
+	m_isDrawResident = false;
+	m_isHistogramDirty = true;
+	// The descriptors of the released buffers may be reused, so the tables referring to them are dropped
+	if (!m_retiredBuffers[frameIndex].empty()) m_tableCache.clear();
+	m_retiredBuffers[frameIndex].clear();
+	decayBuffers();
+
+	// The frame that last used this slot has completed, so choose the bin threshold from its area histogram
+	const auto histogramSize = sizeof(uint32_t[AREA_HISTOGRAM_SIZE]);
+	const Range range(histogramSize * frameIndex, histogramSize * (frameIndex + 1));
+	const auto pAreaHistogram = static_cast<const uint32_t*>(m_areaHistogramReadback->Map(&range));
+	m_binThreshold = selectBinThreshold(pAreaHistogram + AREA_HISTOGRAM_SIZE * frameIndex);
+	m_areaHistogramReadback->Unmap();
+
+	// Keep the depth pyramid mip of that frame for the CPU occlusion queries, and consume the
+	// slot, so that a frame not building the pyramid does not reload it
+	auto& pyramidReadback = m_pyramidReadbacks[frameIndex];
+	if (pyramidReadback.Width > 0)
+	{
+		const auto pyramidMipSize = sizeof(uint32_t[PYRAMID_READBACK_SIZE * PYRAMID_READBACK_SIZE]);
+		const Range range(pyramidMipSize * frameIndex, pyramidMipSize * (frameIndex + 1));
+		const auto pData = static_cast<const uint32_t*>(m_pyramidReadback->Map(&range));
+		const auto pMip = pData + PYRAMID_READBACK_SIZE * PYRAMID_READBACK_SIZE * frameIndex;
+		m_pyramidCache.assign(pMip, pMip + pyramidReadback.Width * pyramidReadback.Height);
+		m_pyramidCacheInfo = pyramidReadback;
+		m_pyramidReadback->Unmap();
+		pyramidReadback.Width = 0;
+	}
+	else m_pyramidCache.clear();
 }
 
 void SoftGraphicsPipeline::VSSetDescriptorTable(uint32_t i, const DescriptorTable& descriptorTable)
@@ -187,6 +564,11 @@ void SoftGraphicsPipeline::VSSetDescriptorTable(uint32_t i, const DescriptorTabl
 	m_extVsTables[i] = descriptorTable;
 }
 
+void SoftGraphicsPipeline::VSSetDataHash(uint64_t hash)
+{
+	m_vsDataHash = hash;
+}
+
 void SoftGraphicsPipeline::PSSetDescriptorTable(uint32_t i, const DescriptorTable& descriptorTable)
 {
 	m_extPsTables[i] = descriptorTable;
@@ -194,18 +576,20 @@ void SoftGraphicsPipeline::PSSetDescriptorTable(uint32_t i, const DescriptorTabl
 
 void SoftGraphicsPipeline::ClearFloat(const Texture2D& target, const float clearValues[4])
 {
-	m_clears.emplace_back();
-	m_clears.back().IsUint = false;
-	m_clears.back().pTarget = &target;
-	memcpy(m_clears.back().ClearFloat, clearValues, sizeof(float[4]));
+	assert(m_numClears < MaxColorTargets);
+	auto& clear = m_clears[m_numClears++];
+	clear.IsUint = false;
+	clear.pTarget = &target;
+	memcpy(clear.ClearFloat, clearValues, sizeof(float[4]));
 }
 
 void SoftGraphicsPipeline::ClearUint(const Texture2D& target, const uint32_t clearValues[4])
 {
-	m_clears.emplace_back();
-	m_clears.back().IsUint = true;
-	m_clears.back().pTarget = &target;
-	memcpy(m_clears.back().ClearUint, clearValues, sizeof(uint32_t[4]));
+	assert(m_numClears < MaxColorTargets);
+	auto& clear = m_clears[m_numClears++];
+	clear.IsUint = true;
+	clear.pTarget = &target;
+	memcpy(clear.ClearUint, clearValues, sizeof(uint32_t[4]));
 }
 
 void SoftGraphicsPipeline::ClearDepth(const float clearValue)
@@ -213,50 +597,184 @@ void SoftGraphicsPipeline::ClearDepth(const float clearValue)
 	m_clearDepth = reinterpret_cast<const uint32_t&>(clearValue);
 }
 
-void SoftGraphicsPipeline::Draw(CommandList* pCommandList, uint32_t numVertices)
+bool SoftGraphicsPipeline::Draw(CommandList* pCommandList, uint32_t numVertices)
+{
+	return DrawInstanced(pCommandList, numVertices, 1);
+}
+
+bool SoftGraphicsPipeline::DrawIndexed(CommandList* pCommandList, uint32_t numIndices)
+{
+	return DrawIndexedInstanced(pCommandList, numIndices, 1);
+}
+
+bool SoftGraphicsPipeline::DrawInstanced(CommandList* pCommandList, uint32_t numVertices, uint32_t numInstances)
+{
+	const DrawArgs args = { numVertices, numInstances, 0, 0, 0 };
+
+	return DrawBatch(pCommandList, 1, &args);
+}
+
+bool SoftGraphicsPipeline::DrawIndexedInstanced(CommandList* pCommandList, uint32_t numIndices, uint32_t numInstances)
+{
+	const DrawArgs args = { numIndices, numInstances, 0, 0, 0 };
+
+	return DrawIndexedBatch(pCommandList, 1, &args);
+}
+
+bool SoftGraphicsPipeline::DrawBatch(CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws)
 {
-	const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 	const Descriptor descriptors[] =
 	{
-		m_vertexBufferView
+		m_vertexBufferView,
+		m_drawRecords->GetSRV()
 	};
-	descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
-	m_srvTables[SRV_TABLE_VS] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
+	m_srvTables[SRV_TABLE_VS] = getCachedTable(static_cast<uint32_t>(size(descriptors)), descriptors);
 
-	draw(pCommandList, numVertices, VERTEX_PROCESS);
+	return draw(pCommandList, numDraws, pDraws, VERTEX_PROCESS);
 }
 
-void SoftGraphicsPipeline::DrawIndexed(CommandList* pCommandList, uint32_t numIndices)
+bool SoftGraphicsPipeline::DrawIndexedBatch(CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws)
 {
-	const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 	const Descriptor descriptors[] =
 	{
 		m_vertexBufferView,
+		m_drawRecords->GetSRV(),
 		m_indexBufferView
 	};
-	descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
-	m_srvTables[SRV_TABLE_VS] = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
+	m_srvTables[SRV_TABLE_VS] = getCachedTable(static_cast<uint32_t>(size(descriptors)), descriptors);
 
-	draw(pCommandList, numIndices, VERTEX_INDEXED);
+	return draw(pCommandList, numDraws, pDraws, VERTEX_INDEXED);
+}
+
+bool SoftGraphicsPipeline::DrawIndexedIndirect(CommandList* pCommandList, const StructuredBuffer* pObjects,
+	uint32_t numObjects, uint32_t maxVertices, CXMMATRIX viewProj)
+{
+	XUSG_N_RETURN(numObjects <= MAX_DRAW_OBJECTS, false);
+	if (numObjects == 0 || maxVertices < 3) return true;
+
+	const Descriptor descriptors[] =
+	{
+		m_vertexBufferView,
+		m_culledRecords->GetSRV(),
+		m_indexBufferView
+	};
+	m_srvTables[SRV_TABLE_VS] = getCachedTable(static_cast<uint32_t>(size(descriptors)), descriptors);
+	m_srvTables[SRV_TABLE_CULL] = getCachedTable(1, &pObjects->GetSRV());
+
+	// The vertex count of the visible objects is unknown on the CPU, so the
+	// buffers and the per-view strides are sized by the upper bound
+	CBCull cbCull;
+	XMStoreFloat4x4(&cbCull.ViewProj, XMMatrixTranspose(viewProj));
+
+	// The eye point maps to w = 0, and is at infinity for the orthographic projections,
+	// which skip the back-face tests of the normal cones
+	const auto eyePt = XMVector4Transform(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMMatrixInverse(nullptr, viewProj));
+	const auto eyeW = XMVectorGetW(eyePt);
+	if (fabs(eyeW) > FLT_EPSILON) XMStoreFloat4(&cbCull.EyePt, XMVectorSetW(eyePt / eyeW, 1.0f));
+	else cbCull.EyePt = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+	cbCull.NumObjects = numObjects;
+	cbCull.NumViews = m_numViews;
+	cbCull.CullPass = 0;
+	return drawRecords(pCommandList, maxVertices / 3 * 3, numObjects, 0, VERTEX_INDEXED, &cbCull);
+}
+
+void SoftGraphicsPipeline::BuildDepthPyramid(CommandList* pCommandList)
+{
+	assert(m_pDepth);
+	const auto pPyramid = m_pDepth->Pyramid.get();
+	const auto width = static_cast<uint32_t>(pPyramid->GetWidth());
+	const auto height = pPyramid->GetHeight();
+
+	// PixelZ has been written by the pixel raster
+	const auto barriers = m_barriers.data();
+	const auto pMip = m_transients[TRANSIENT_PYRAMID_MIP];
+	const BufferAccess mipWrite = { pMip, ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	auto numBarriers = m_pDepth->PixelZ->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS);
+	numBarriers = pPyramid->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	transition(pCommandList, 1, &mipWrite, numBarriers);
+
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[DEPTH_PYRAMID]);
+	pCommandList->SetPipelineState(m_pipelines[DEPTH_PYRAMID]);
+
+	// The first mip small enough is also read back
+	const auto numMips = pPyramid->GetNumMips();
+	auto& readback = m_pyramidReadbacks[m_frameIndex];
+	readback.Mip = numMips - 1;
+	for (uint8_t i = 0; i < numMips; ++i)
+	{
+		if ((width >> i) <= PYRAMID_READBACK_SIZE && (height >> i) <= PYRAMID_READBACK_SIZE)
+		{
+			readback.Mip = i;
+			break;
+		}
+	}
+	readback.Width = (max)(width >> readback.Mip, 1u);
+	readback.Height = (max)(height >> readback.Mip, 1u);
+	readback.DepthFlip = m_depthFlip;
+
+	for (uint8_t i = 0; i < numMips; ++i)
+	{
+		// Each mip reads the previous one
+		if (i > 0)
+		{
+			numBarriers = pPyramid->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS);
+			pCommandList->Barrier(numBarriers, barriers);
+		}
+
+		const uint32_t isReadback = i == readback.Mip;
+		pCommandList->SetCompute32BitConstant(0, isReadback);
+		pCommandList->SetComputeDescriptorTable(1, m_pyramidTables[i]);
+		pCommandList->Dispatch(XUSG_DIV_UP((max)(width >> i, 1u), 8), XUSG_DIV_UP((max)(height >> i, 1u), 8), 1);
+	}
+
+	const BufferAccess mipRead = { pMip, ResourceState::COPY_SOURCE, ACCESS_READ };
+	numBarriers = pPyramid->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	transition(pCommandList, 1, &mipRead, numBarriers);
+
+	const auto pyramidMipSize = sizeof(uint32_t[PYRAMID_READBACK_SIZE * PYRAMID_READBACK_SIZE]);
+	pCommandList->CopyBufferRegion(m_pyramidReadback.get(), pyramidMipSize * m_frameIndex,
+		pMip, 0, sizeof(uint32_t) * readback.Width * readback.Height);
 }
 
 bool SoftGraphicsPipeline::CreateDepthBuffer(const Device* pDevice, DepthBuffer& depth,
 	uint32_t width, uint32_t height, Format format, const wchar_t* name)
 {
+	// The recreated depth buffer may take the place of the resident one
+	m_drawHash = m_lastDrawHash = 0;
+
 	depth.PixelZ = Texture2D::MakeUnique();
 	XUSG_N_RETURN(depth.PixelZ->Create(pDevice, width, height, format, 1,
 		ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
 		1, 1, false, MemoryFlag::NONE, (wstring(name) + L".PixelZ").c_str()), false);
 
+	const auto tileSize = 1u << m_tileSizeLog;
+
 	depth.TileZ = Texture2D::MakeUnique();
-	XUSG_N_RETURN(depth.TileZ->Create(pDevice, XUSG_DIV_UP(width, TILE_SIZE), XUSG_DIV_UP(height, TILE_SIZE),
+	XUSG_N_RETURN(depth.TileZ->Create(pDevice, XUSG_DIV_UP(width, tileSize), XUSG_DIV_UP(height, tileSize),
 		format, 1, ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
 		1, 1, false, MemoryFlag::NONE, (wstring(name) + L".TileZ").c_str()), false);
 
-	depth.BinZ = Texture2D::MakeUnique();
-	XUSG_N_RETURN(depth.BinZ->Create(pDevice, XUSG_DIV_UP(width, BIN_SIZE), XUSG_DIV_UP(height, BIN_SIZE),
-		format, 1, ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
-		1, 1, false, MemoryFlag::NONE, (wstring(name) + L".BinZ").c_str()), false);
+	for (uint8_t i = 0; i < MAX_BIN_LEVELS; ++i)
+	{
+		const auto binSize = tileSize << (m_tileToBinLog * (i + 1));
+		const auto level = i > 0 ? to_wstring(i) : wstring();
+
+		depth.BinZ[i] = Texture2D::MakeUnique();
+		XUSG_N_RETURN(depth.BinZ[i]->Create(pDevice, XUSG_DIV_UP(width, binSize), XUSG_DIV_UP(height, binSize),
+			format, 1, ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
+			1, 1, false, MemoryFlag::NONE, (wstring(name) + L".BinZ" + level).c_str()), false);
+	}
+
+	// Full mip chain from the half resolution
+	depth.Pyramid = Texture2D::MakeUnique();
+	XUSG_N_RETURN(depth.Pyramid->Create(pDevice, XUSG_DIV_UP(width, 2), XUSG_DIV_UP(height, 2),
+		format, 1, ResourceFlag::ALLOW_UNORDERED_ACCESS, 0, 1, false, MemoryFlag::NONE,
+		(wstring(name) + L".Pyramid").c_str()), false);
+	assert(isPyramidEdgeCovered(width, depth.Pyramid->GetNumMips()));
+	assert(isPyramidEdgeCovered(height, depth.Pyramid->GetNumMips()));
+
+	// The descriptor tables refer to the depth buffer
+	m_isTableDirty = true;
 
 	return true;
 }
@@ -294,16 +812,75 @@ DescriptorTableLib* SoftGraphicsPipeline::GetDescriptorTableLib() const
 	return m_descriptorTableLib.get();
 }
 
-bool SoftGraphicsPipeline::createPipelines()
+uint8_t SoftGraphicsPipeline::GetTileSizeLog() const
+{
+	return m_tileSizeLog;
+}
+
+uint8_t SoftGraphicsPipeline::GetTileToBinLog() const
+{
+	return m_tileToBinLog;
+}
+
+uint8_t SoftGraphicsPipeline::GetBinLevels() const
+{
+	return m_numBinLevels;
+}
+
+uint8_t SoftGraphicsPipeline::GetFeatures() const
+{
+	return m_features;
+}
+
+uint64_t SoftGraphicsPipeline::Hash(const void* pData, size_t size, uint64_t seed)
+{
+	// FNV-1a, chained through the seed
+	const auto pBytes = static_cast<const uint8_t*>(pData);
+	for (size_t i = 0; i < size; ++i) seed = (seed ^ pBytes[i]) * 1099511628211ull;
+
+	return seed;
+}
+
+bool SoftGraphicsPipeline::IsOccluded(float left, float top, float right, float bottom, float zMin) const
+{
+	if (m_pyramidCache.empty() || zMin < 0.0f) return false;
+
+	// The texels of the read-back mip cover 2^(mip+1) x 2^(mip+1) pixels, and the last row and
+	// column also cover the remaining edge pixels (see DepthPyramid.hlsl), so the rects clamp onto them
+	const auto texelSizeLog = m_pyramidCacheInfo.Mip + 1;
+	left = (max)(left, 0.0f);
+	top = (max)(top, 0.0f);
+	right = (max)(right - 0.5f, left);
+	bottom = (max)(bottom - 0.5f, top);
+	const auto x0 = (min)(static_cast<uint32_t>(left) >> texelSizeLog, m_pyramidCacheInfo.Width - 1);
+	const auto y0 = (min)(static_cast<uint32_t>(top) >> texelSizeLog, m_pyramidCacheInfo.Height - 1);
+	const auto x1 = (min)(static_cast<uint32_t>(right) >> texelSizeLog, m_pyramidCacheInfo.Width - 1);
+	const auto y1 = (min)(static_cast<uint32_t>(bottom) >> texelSizeLog, m_pyramidCacheInfo.Height - 1);
+
+	auto zMax = 0u;
+	for (auto y = y0; y <= y1; ++y)
+		for (auto x = x0; x <= x1; ++x)
+			zMax = (max)(m_pyramidCache[m_pyramidCacheInfo.Width * y + x], zMax);
+
+	// The depth is stored as the keys of the positive floats, of which the smaller is the nearer
+	uint32_t z;
+	memcpy(&z, &zMin, sizeof(uint32_t));
+	z ^= m_pyramidCacheInfo.DepthFlip;
+
+	return z > zMax;
+}
+
+bool SoftGraphicsPipeline::createPipelineLayouts()
 {
-	// Create pipeline layouts
 	{
 		const auto utilPipelineLayout = Util::PipelineLayout::MakeUnique();
 		utilPipelineLayout->SetConstants(0, XUSG_UINT32_SIZE_OF(CBViewPort), 0);
-		utilPipelineLayout->SetRange(1, DescriptorType::UAV, 7, 0, 0,
+		utilPipelineLayout->SetRange(1, DescriptorType::UAV, 8 + 3 * MAX_BIN_LEVELS, 0, 0,
 			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		utilPipelineLayout->SetRange(2, DescriptorType::SRV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		XUSG_X_RETURN(m_pipelineLayouts[BIN_RASTER], utilPipelineLayout->GetPipelineLayout(
 			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"BinRasterLayout"), false);
+		m_layoutKeys[BIN_RASTER] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 	}
 
 	{
@@ -314,54 +891,188 @@ bool SoftGraphicsPipeline::createPipelines()
 			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		XUSG_X_RETURN(m_pipelineLayouts[TILE_RASTER], utilPipelineLayout->GetPipelineLayout(
 			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"TileRasterLayout"), false);
+		m_layoutKeys[TILE_RASTER] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 	}
 
-	// Create compute pipelines
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, VERTEX_PROCESS, L"VSStage.cso"), false);
+		// Shared by all the passes building the tile lists
+		const auto utilPipelineLayout = Util::PipelineLayout::MakeUnique();
+		utilPipelineLayout->SetConstants(0, XUSG_UINT32_SIZE_OF(CBViewPort), 0);
+		utilPipelineLayout->SetRange(1, DescriptorType::UAV, 4, 0, 0,
+			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		XUSG_X_RETURN(m_pipelineLayouts[TILE_COUNT], utilPipelineLayout->GetPipelineLayout(
+			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"TileListLayout"), false);
+		m_layoutKeys[TILE_COUNT] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 
-		const auto state = Compute::State::MakeUnique();
-		state->SetPipelineLayout(m_pipelineLayouts[VERTEX_PROCESS]);
-		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, VERTEX_PROCESS));
-		XUSG_X_RETURN(m_pipelines[VERTEX_PROCESS], state->GetPipeline(m_computePipelineLib.get(), L"VertexShaderStage"), false);
+		for (const auto i : { TILE_SCAN, TILE_SCATTER, TILE_SORT })
+		{
+			m_pipelineLayouts[i] = m_pipelineLayouts[TILE_COUNT];
+			m_layoutKeys[i] = m_layoutKeys[TILE_COUNT];
+		}
 	}
 
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, VERTEX_INDEXED, L"VSStageIndexed.cso"), false);
+		// Depth-only pixel raster, of which PixelZ and TileZ are the only outputs
+		const auto utilPipelineLayout = Util::PipelineLayout::MakeUnique();
+		utilPipelineLayout->SetConstants(0, XUSG_UINT32_SIZE_OF(CBViewPort), 0);
+		utilPipelineLayout->SetRange(1, DescriptorType::SRV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		utilPipelineLayout->SetRange(2, DescriptorType::UAV, 1, 0, 0,
+			DescriptorFlag::DESCRIPTORS_VOLATILE | DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		utilPipelineLayout->SetRange(3, DescriptorType::UAV, 2, 1, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		XUSG_X_RETURN(m_pipelineLayouts[PIX_RASTER_DEPTH], utilPipelineLayout->GetPipelineLayout(
+			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"PixelRasterDepthLayout"), false);
+		m_layoutKeys[PIX_RASTER_DEPTH] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
+	}
 
-		const auto state = Compute::State::MakeUnique();
-		state->SetPipelineLayout(m_pipelineLayouts[VERTEX_INDEXED]);
-		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, VERTEX_INDEXED));
-		XUSG_X_RETURN(m_pipelines[VERTEX_INDEXED], state->GetPipeline(m_computePipelineLib.get(), L"VertexShaderStageIndexed"), false);
+	{
+		const auto utilPipelineLayout = Util::PipelineLayout::MakeUnique();
+		utilPipelineLayout->SetConstants(0, 1, 0);
+		utilPipelineLayout->SetRange(1, DescriptorType::UAV, 3, 0, 0, DescriptorFlag::DESCRIPTORS_VOLATILE);
+		XUSG_X_RETURN(m_pipelineLayouts[DEPTH_PYRAMID], utilPipelineLayout->GetPipelineLayout(
+			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"DepthPyramidLayout"), false);
+		m_layoutKeys[DEPTH_PYRAMID] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
 	}
 
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, BIN_RASTER, L"BinRaster.cso"), false);
+		const auto utilPipelineLayout = Util::PipelineLayout::MakeUnique();
+		utilPipelineLayout->SetConstants(0, XUSG_UINT32_SIZE_OF(CBViewPort), 0);
+		utilPipelineLayout->SetConstants(1, XUSG_UINT32_SIZE_OF(CBCull), 1);
+		utilPipelineLayout->SetRange(2, DescriptorType::SRV, 1, 0, 0, DescriptorFlag::DESCRIPTORS_VOLATILE);
+		utilPipelineLayout->SetRange(3, DescriptorType::SRV, 1, 1, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		utilPipelineLayout->SetRange(4, DescriptorType::UAV, 3, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		XUSG_X_RETURN(m_pipelineLayouts[DRAW_CULL], utilPipelineLayout->GetPipelineLayout(
+			m_pipelineLayoutLib.get(), PipelineLayoutFlag::NONE, L"DrawCullLayout"), false);
+		m_layoutKeys[DRAW_CULL] = utilPipelineLayout->GetPipelineLayoutKey(m_pipelineLayoutLib.get());
+	}
+
+	return true;
+}
+
+bool SoftGraphicsPipeline::createPipeline(StageIndex index, Compute::PipelineLib* pPipelineLib)
+{
+	com_ptr<ID3DBlob> shader;
+	XUSG_N_RETURN(loadShader(index, shader), false);
+
+	// Keyed by the bytecode and the layout, so that the changes of either miss the cache
+	const auto& layoutKey = m_layoutKeys[index];
+	const auto key = Hash(layoutKey.data(), layoutKey.size(),
+		Hash(shader->GetBufferPointer(), shader->GetBufferSize()));
+	wstringstream fileName;
+	fileName << g_pipelineCacheDir << L"/" << hex << setw(16) << setfill(L'0') << key << L".bin";
 
-		const auto state = Compute::State::MakeUnique();
-		state->SetPipelineLayout(m_pipelineLayouts[BIN_RASTER]);
-		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, BIN_RASTER));
-		XUSG_X_RETURN(m_pipelines[BIN_RASTER], state->GetPipeline(m_computePipelineLib.get(), L"BinRaster"), false);
+	const auto state = Compute::State::MakeUnique();
+	state->SetPipelineLayout(m_pipelineLayouts[index]);
+	state->SetShader(shader.get());
+
+	// Warm start from the cached pipeline, which the driver rejects after its updates
+	{
+		com_ptr<ID3DBlob> cachedPipeline;
+		ifstream fileIn(fileName.str(), ios::binary | ios::ate);
+		const auto size = fileIn ? static_cast<size_t>(fileIn.tellg()) : 0;
+		if (size > 0 && SUCCEEDED(D3DCreateBlob(size, cachedPipeline.put())) && fileIn.seekg(0) &&
+			fileIn.read(static_cast<char*>(cachedPipeline->GetBufferPointer()), size))
+		{
+			state->SetCachedPipeline(cachedPipeline.get());
+			m_pipelines[index] = state->CreatePipeline(pPipelineLib, StageInfos[index].Name);
+			if (m_pipelines[index]) return true;
+			state->SetCachedPipeline(nullptr);
+		}
 	}
 
+	XUSG_X_RETURN(m_pipelines[index], state->GetPipeline(pPipelineLib, StageInfos[index].Name), false);
+
+	// Best effort, a failed write only costs the compilation on the next start
+	com_ptr<ID3DBlob> cachedPipeline;
+	if (SUCCEEDED(static_cast<ID3D12PipelineState*>(m_pipelines[index])->GetCachedBlob(cachedPipeline.put())))
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, TILE_RASTER, L"TileRaster.cso"), false);
+		ofstream fileOut(fileName.str(), ios::binary);
+		fileOut.write(static_cast<const char*>(cachedPipeline->GetBufferPointer()), cachedPipeline->GetBufferSize());
+	}
 
-		const auto state = Compute::State::MakeUnique();
-		state->SetPipelineLayout(m_pipelineLayouts[TILE_RASTER]);
-		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, TILE_RASTER));
-		XUSG_X_RETURN(m_pipelines[TILE_RASTER], state->GetPipeline(m_computePipelineLib.get(), L"TileRaster"), false);
+	return true;
+}
+
+bool SoftGraphicsPipeline::loadShader(StageIndex index, com_ptr<ID3DBlob>& shader)
+{
+	// The precompiled shaders are built with the default tile sizes and features
+	const auto& info = StageInfos[index];
+	const wstring name = info.FileName;
+	const auto features = m_features & info.Features;
+	const auto isTileSized = info.IsTileSized && (m_tileSizeLog != TILE_SIZE_LOG || m_tileToBinLog != TILE_TO_BIN_LOG);
+	if (!isTileSized && features == (DefaultFeatures & info.Features))
+		return SUCCEEDED(D3DReadFileToBlob((name + L".cso").c_str(), shader.put()));
+
+	// Otherwise, the permutation is keyed by its preprocessed source, so that the edits of the shader
+	// or its includes miss the library, and by the shader name and the macros
+	const auto tileSizeLog = to_string(m_tileSizeLog);
+	const auto tileToBinLog = to_string(m_tileToBinLog);
+	vector<D3D_SHADER_MACRO> macros;
+	macros.reserve(m_shaderDefines.size() + 7);
+	if (info.IsTileSized)
+	{
+		macros.push_back({ "TILE_SIZE_LOG", tileSizeLog.c_str() });
+		macros.push_back({ "TILE_TO_BIN_LOG", tileToBinLog.c_str() });
+	}
+	if (info.Features & FEATURE_HI_Z) macros.push_back({ "HI_Z", features & FEATURE_HI_Z ? "1" : "0" });
+	if (info.Features & FEATURE_RE_HI_Z) macros.push_back({ "RE_HI_Z", features & FEATURE_RE_HI_Z ? "1" : "0" });
+	if (info.Features & FEATURE_MUTEX) macros.push_back({ "USE_MUTEX",
+		features & FEATURE_MUTEX_DEPTH_ORDERED ? "2" : (features & FEATURE_MUTEX ? "1" : "0") });
+	if (info.Features & FEATURE_VRS) macros.push_back({ "SHADING_RATE", features & FEATURE_VRS ? "1" : "0" });
+	if (info.HasAttributes)
+		for (const auto& define : m_shaderDefines)
+			macros.push_back({ define.Name.c_str(), define.Definition.c_str() });
+
+	auto key = Hash(name.data(), sizeof(wchar_t) * name.size());
+	for (const auto& macro : macros)
+	{
+		key = Hash(macro.Name, strlen(macro.Name) + 1, key);
+		key = Hash(macro.Definition, strlen(macro.Definition) + 1, key);
 	}
+	macros.push_back({ nullptr, nullptr });
 
+	const auto sourceFile = L"Shaders/" + name + L".hlsl";
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, PIX_RASTER, L"PixelRaster.cso"), false);
+		const auto sourceName = string(sourceFile.cbegin(), sourceFile.cend());
+		com_ptr<ID3DBlob> source, preprocessed, errors;
+		XUSG_N_RETURN(SUCCEEDED(D3DReadFileToBlob(sourceFile.c_str(), source.put())), false);
+		const auto hr = D3DPreprocess(source->GetBufferPointer(), source->GetBufferSize(), sourceName.c_str(),
+			macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE, preprocessed.put(), errors.put());
+		if (errors) OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+		XUSG_N_RETURN(SUCCEEDED(hr), false);
+		key = Hash(preprocessed->GetBufferPointer(), preprocessed->GetBufferSize(), key);
+	}
 
-		const auto state = Compute::State::MakeUnique();
-		state->SetPipelineLayout(m_pipelineLayouts[PIX_RASTER]);
-		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, PIX_RASTER));
-		XUSG_X_RETURN(m_pipelines[PIX_RASTER], state->GetPipeline(m_computePipelineLib.get(), L"BinRaster"), false);
+	wstringstream fileName;
+	fileName << g_permutationLibDir << L"/" << hex << setw(16) << setfill(L'0') << key << L".cso";
+
+	// The library may also be built offline from its index, e.g., with DXC, where the stale
+	// entries of the edited sources are no longer looked up
+	if (SUCCEEDED(D3DReadFileToBlob(fileName.str().c_str(), shader.put()))) return true;
+
+#if defined(_DEBUG)
+	const uint32_t compileFlags = D3DCOMPILE_ALL_RESOURCES_BOUND | D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+	const uint32_t compileFlags = D3DCOMPILE_ALL_RESOURCES_BOUND | D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+
+	com_ptr<ID3DBlob> errors;
+	const auto hr = D3DCompileFromFile(sourceFile.c_str(), macros.data(),
+		D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "cs_5_0", compileFlags, 0, shader.put(), errors.put());
+	if (errors) OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+	XUSG_N_RETURN(SUCCEEDED(hr), false);
+
+	// Add the permutation to the library, of which the index lists the macros of each entry
+	{
+		ofstream fileOut(fileName.str(), ios::binary);
+		fileOut.write(static_cast<const char*>(shader->GetBufferPointer()), shader->GetBufferSize());
 	}
 
+	const lock_guard<mutex> lock(m_permutationMutex);
+	wofstream index(wstring(g_permutationLibDir) + L"/Index.txt", ios::app);
+	index << hex << setw(16) << setfill(L'0') << key << L'\t' << name << L".hlsl";
+	for (auto i = 0u; i + 1 < macros.size(); ++i) index << L'\t' << macros[i].Name << L'=' << macros[i].Definition;
+	index << endl;
+
 	return true;
 }
 
@@ -375,12 +1086,65 @@ bool SoftGraphicsPipeline::createResetBuffer(CommandList* pCommandList, vector<R
 	uploaders.emplace_back(Resource::MakeUnique());
 	XUSG_N_RETURN(m_tilePrimCount->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t[3])), false);
 
+	for (const auto& binPrimCount : m_binPrimCounts)
+	{
+		uploaders.emplace_back(Resource::MakeUnique());
+		XUSG_N_RETURN(binPrimCount->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t[3])), false);
+	}
+
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_rejectedArgs->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t[3])), false);
+
 	uploaders.emplace_back(Resource::MakeUnique());
-	XUSG_N_RETURN(m_binPrimCount->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t[3])), false);
+	XUSG_N_RETURN(m_tilePrimCountReset->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t)), false);
+
+	m_areaHistogramReset = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_areaHistogramReset->Create(pCommandList->GetDevice(), AREA_HISTOGRAM_SIZE, sizeof(uint32_t),
+		ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 1, nullptr, MemoryFlag::NONE, L"AreaHistogramReset"), false);
 
+	const uint32_t pHistogramReset[AREA_HISTOGRAM_SIZE] = {};
 	uploaders.emplace_back(Resource::MakeUnique());
 
-	return m_tilePrimCountReset->Upload(pCommandList, uploaders.back().get(), pDataReset, sizeof(uint32_t));
+	return m_areaHistogramReset->Upload(pCommandList, uploaders.back().get(), pHistogramReset, sizeof(pHistogramReset));
+}
+
+float SoftGraphicsPipeline::selectBinThreshold(const uint32_t* pAreaHistogram) const
+{
+	// Rough relative costs in wave iterations: a thread in the bin raster walks the overlapped
+	// tiles or bins serially, a bin primitive launches a tile raster group, and the tile raster
+	// pass itself costs a barrier and an indirect dispatch.
+	const auto tileArea = static_cast<float>(1 << (2 * m_tileSizeLog));
+	const auto binArea = tileArea * (1 << (2 * m_tileToBinLog));
+	const auto groupCost = (1 << (2 * m_tileToBinLog)) / 64.0f + 1.0f;
+	const auto passCost = 1024.0f;
+
+	// Route the buckets [0, t) to the tiles and [t, AREA_HISTOGRAM_SIZE) to the bins
+	auto numPrims = 0u;
+	auto minCost = FLT_MAX;
+	auto bestSplit = AREA_HISTOGRAM_SIZE;
+	for (auto t = 0u; t <= AREA_HISTOGRAM_SIZE; ++t)
+	{
+		auto cost = t < AREA_HISTOGRAM_SIZE ? passCost : 0.0f;
+		for (auto i = 0u; i < AREA_HISTOGRAM_SIZE; ++i)
+		{
+			const auto count = static_cast<float>(pAreaHistogram[i]);
+			const auto area = 0.75f * (1 << i); // Bucket i holds the doubled areas in [2^i, 2^(i + 1))
+			if (i < t) cost += count * (area / tileArea + 1.0f);
+			else cost += count * (area / binArea + 1.0f) * (1.0f + groupCost);
+			if (t == 0) numPrims += pAreaHistogram[i];
+		}
+
+		if (cost < minCost)
+		{
+			minCost = cost;
+			bestSplit = t;
+		}
+	}
+
+	// Keep the default before any feedback
+	if (numPrims == 0) return 0.0f;
+
+	return bestSplit < AREA_HISTOGRAM_SIZE ? static_cast<float>(1 << bestSplit) : FLT_MAX;
 }
 
 bool SoftGraphicsPipeline::createCommandLayout(const Device* pDevice)
@@ -392,25 +1156,68 @@ bool SoftGraphicsPipeline::createCommandLayout(const Device* pDevice)
 	return m_commandLayout->Create(pDevice, sizeof(uint32_t[3]), 1, &arg);
 }
 
+bool SoftGraphicsPipeline::createDrawCommandLayouts(const Device* pDevice)
+{
+	// The draw count of the vertex stage, followed by its dispatch arguments
+	IndirectArgument args[2];
+	args[0].Type = IndirectArgumentType::CONSTANT;
+	args[0].Constant.Index = static_cast<uint32_t>(m_extVsTables.size()) + 2;
+	args[0].Constant.DestOffsetIn32BitValues = 1;
+	args[0].Constant.Num32BitValuesToSet = 1;
+	args[1].Type = IndirectArgumentType::DISPATCH;
+	m_vsCommandLayout = CommandLayout::MakeUnique();
+	XUSG_N_RETURN(m_vsCommandLayout->Create(pDevice, sizeof(uint32_t[4]), static_cast<uint32_t>(size(args)),
+		args, m_pipelineLayouts[VERTEX_PROCESS]), false);
+
+	// The drawn primitive count per view of the bin raster, followed by its dispatch arguments
+	args[0].Constant.Index = 0;
+	args[0].Constant.DestOffsetIn32BitValues = offsetof(CBViewPort, NumDrawPrims) / sizeof(uint32_t);
+	m_binCommandLayout = CommandLayout::MakeUnique();
+
+	return m_binCommandLayout->Create(pDevice, sizeof(uint32_t[4]), static_cast<uint32_t>(size(args)),
+		args, m_pipelineLayouts[BIN_RASTER]);
+}
+
 bool SoftGraphicsPipeline::createDescriptorTables()
 {
+	// Refine passes, bin level i is refined into level i - 1, or into the tiles
+	for (uint8_t i = 0; i < MAX_BIN_LEVELS; ++i)
 	{
-		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
-		const Descriptor descriptors[] =
 		{
-			m_binPrimitives->GetSRV()
-		};
-		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
-		XUSG_X_RETURN(m_srvTables[SRV_TABLE_TR], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+			const Descriptor descriptors[] =
+			{
+				m_transients[TRANSIENT_BIN_PRIMS + i]->GetSRV()
+			};
+			descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+			XUSG_X_RETURN(m_srvTables[SRV_TABLE_TR + i], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+		}
+
+		{
+			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+			vector<Descriptor> descriptors;
+			descriptors.reserve(5);
+			descriptors.push_back(m_vertexPos->GetUAV());
+			descriptors.push_back(i > 0 ? m_binPrimCounts[i - 1]->GetUAV() : m_tilePrimCount->GetUAV());
+			descriptors.push_back(i > 0 ? m_transients[TRANSIENT_BIN_PRIMS + i - 1]->GetUAV() : m_tilePrimitives->GetUAV());
+			if (m_pDepth)
+			{
+				descriptors.push_back(i > 0 ? m_pDepth->BinZ[i - 1]->GetUAV() : m_pDepth->TileZ->GetUAV());
+				descriptors.push_back(m_pDepth->BinZ[i]->GetUAV());
+			}
+			descriptorTable->SetDescriptors(0, static_cast<uint32_t>(descriptors.size()), descriptors.data());
+			XUSG_X_RETURN(m_uavTables[UAV_TABLE_TR + i], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+		}
 	}
 
 	const auto numAttribs = static_cast<uint32_t>(m_vertexAttribs.size());
 	{
 		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 		vector<Descriptor> descriptors;
-		descriptors.reserve(numAttribs + 1);
+		descriptors.reserve(numAttribs + 2);
 		descriptors.push_back(m_tilePrimitives->GetSRV());
 		for (const auto& attrib : m_vertexAttribs) descriptors.push_back(attrib->GetSRV());
+		descriptors.push_back(m_primDrawIds->GetSRV());
 		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(descriptors.size()), descriptors.data());
 		XUSG_X_RETURN(m_srvTables[SRV_TABLE_PS], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
 	}
@@ -418,8 +1225,9 @@ bool SoftGraphicsPipeline::createDescriptorTables()
 	{
 		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 		vector<Descriptor> descriptors;
-		descriptors.reserve(numAttribs + 1);
+		descriptors.reserve(numAttribs + 2);
 		descriptors.push_back(m_vertexPos->GetUAV());
+		descriptors.push_back(m_primDrawIds->GetUAV());
 		for (const auto& attrib : m_vertexAttribs) descriptors.push_back(attrib->GetUAV());
 		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(descriptors.size()), descriptors.data());
 		XUSG_X_RETURN(m_uavTables[UAV_TABLE_VS], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
@@ -428,36 +1236,359 @@ bool SoftGraphicsPipeline::createDescriptorTables()
 	{
 		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 		vector<Descriptor> descriptors;
-		descriptors.reserve(7);
+		descriptors.reserve(8 + 3 * MAX_BIN_LEVELS);
 		descriptors.push_back(m_vertexPos->GetUAV()),
 		descriptors.push_back(m_tilePrimCount->GetUAV());
 		descriptors.push_back(m_tilePrimitives->GetUAV());
 		if (m_pDepth)
 		{
 			descriptors.push_back(m_pDepth->TileZ->GetUAV());
-			descriptors.push_back(m_pDepth->BinZ->GetUAV());
+			for (const auto& binZ : m_pDepth->BinZ) descriptors.push_back(binZ->GetUAV());
 		}
-		descriptors.push_back(m_binPrimCount->GetUAV());
-		descriptors.push_back(m_binPrimitives->GetUAV());
+		for (const auto& binPrimCount : m_binPrimCounts) descriptors.push_back(binPrimCount->GetUAV());
+		for (uint8_t i = 0; i < MAX_BIN_LEVELS; ++i) descriptors.push_back(m_transients[TRANSIENT_BIN_PRIMS + i]->GetUAV());
+		descriptors.push_back(m_areaHistogram->GetUAV());
+		descriptors.push_back(m_rejectedCount->GetUAV());
+		descriptors.push_back(m_rejectedArgs->GetUAV());
+		descriptors.push_back(m_transients[TRANSIENT_REJECTED_PRIMS]->GetUAV());
 		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(descriptors.size()), descriptors.data());
 		XUSG_X_RETURN(m_uavTables[UAV_TABLE_RS], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
 	}
 
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		const Descriptor descriptors[] =
+		{
+			m_culledRecords->GetUAV(),
+			m_drawArgs->GetUAV(),
+			m_rejectedObjects->GetUAV()
+		};
+		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+		XUSG_X_RETURN(m_uavTables[UAV_TABLE_CULL], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+	// Depth pyramid, each mip is downsampled from the previous one, or from PixelZ
+	if (m_pDepth)
+	{
+		{
+			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+			descriptorTable->SetDescriptors(0, 1, &m_pDepth->Pyramid->GetSRV());
+			XUSG_X_RETURN(m_srvTables[SRV_TABLE_PYRAMID], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+		}
+
+		const auto numMips = m_pDepth->Pyramid->GetNumMips();
+		m_pyramidTables.resize(numMips);
+		for (uint8_t i = 0; i < numMips; ++i)
+		{
+			const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+			const Descriptor descriptors[] =
+			{
+				i > 0 ? m_pDepth->Pyramid->GetUAV(i - 1) : m_pDepth->PixelZ->GetUAV(),
+				m_pDepth->Pyramid->GetUAV(i),
+				m_transients[TRANSIENT_PYRAMID_MIP]->GetUAV()
+			};
+			descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+			XUSG_X_RETURN(m_pyramidTables[i], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+		}
+	}
+
+	return true;
+}
+
+bool SoftGraphicsPipeline::createTileListBuffers(const Device* pDevice, uint32_t numTiles)
+{
+	// The draws recorded earlier still refer to the replaced ranges, and a failure leaves
+	// the buffers to be recreated by the next draw
+	if (m_tileListRanges) m_retiredBuffers[m_frameIndex].push_back(move(m_tileListRanges));
+	m_maxTileCount = 0;
+
+	m_tileListRanges = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_tileListRanges->Create(pDevice, numTiles, sizeof(uint32_t[2]),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT, 1,
+		nullptr, 1, nullptr, MemoryFlag::NONE, L"TileListRanges"), false);
+
+	// One entry per tile primitive
+	XUSG_N_RETURN(createTransient(pDevice, TRANSIENT_TILE_LISTS, m_tilePrimitives->GetWidth() / sizeof(uint32_t[2])), false);
+
+	m_maxTileCount = numTiles;
+
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		vector<Descriptor> descriptors;
+		descriptors.reserve(m_vertexAttribs.size() + 3);
+		descriptors.push_back(m_transients[TRANSIENT_TILE_LISTS]->GetSRV());
+		descriptors.push_back(m_tileListRanges->GetSRV());
+		for (const auto& attrib : m_vertexAttribs) descriptors.push_back(attrib->GetSRV());
+		descriptors.push_back(m_primDrawIds->GetSRV());
+		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(descriptors.size()), descriptors.data());
+		XUSG_X_RETURN(m_srvTables[SRV_TABLE_PS_TILED], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+	{
+		// The ranges come first for clearing
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		const Descriptor descriptors[] =
+		{
+			m_tileListRanges->GetUAV(),
+			m_transients[TRANSIENT_TILE_LISTS]->GetUAV(),
+			m_tilePrimCount->GetUAV(),
+			m_tilePrimitives->GetUAV()
+		};
+		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+		XUSG_X_RETURN(m_uavTables[UAV_TABLE_TL], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
 	return true;
 }
 
-void SoftGraphicsPipeline::draw(CommandList* pCommandList, uint32_t num, StageIndex vs)
+bool SoftGraphicsPipeline::createTransient(const Device* pDevice, TransientBuffer transient, size_t numElements)
+{
+	const auto slot = m_transientSlots[transient];
+	auto& buffer = m_physicalTransients[slot];
+	if (buffer && numElements <= m_transientSizes[slot]) return true;
+
+	// The physical buffer grows to the largest of its transients, and the replaced one
+	// is kept until the frames in flight complete
+	if (buffer) m_retiredBuffers[m_frameIndex].push_back(move(buffer));
+	m_transientSizes[slot] = (max)(m_transientSizes[slot], numElements);
+	buffer = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(buffer->Create(pDevice, m_transientSizes[slot], TransientInfos[transient].Stride,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT, 1, nullptr, 1, nullptr,
+		MemoryFlag::NONE, TransientInfos[transient].Name), false);
+
+	for (uint8_t i = 0; i < NUM_TRANSIENT; ++i)
+		if (m_transientSlots[i] == slot) m_transients[i] = buffer.get();
+
+	// The tables refer to the new buffer
+	m_maxTileCount = 0;
+	m_isTableDirty = true;
+
+	return true;
+}
+
+DescriptorTable SoftGraphicsPipeline::getCachedTable(uint32_t numDescriptors, const Descriptor* pDescriptors)
+{
+	// The tables of the draw inputs and the targets are mostly the same every frame, so they are
+	// looked up by the hash of the descriptors, avoiding building the table keys in the library
+	assert(numDescriptors <= size(TableCacheEntry().Descriptors));
+	TableCacheEntry entry = {};
+	copy(pDescriptors, pDescriptors + numDescriptors, entry.Descriptors);
+	const auto key = Hash(entry.Descriptors, sizeof(entry.Descriptors));
+	const auto it = m_tableCache.find(key);
+	if (it != m_tableCache.cend() && equal(entry.Descriptors, entry.Descriptors + size(entry.Descriptors),
+		it->second.Descriptors))
+	{
+		it->second.LastUse = ++m_tableCacheClock;
+
+		return it->second.Table;
+	}
+
+	const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+	descriptorTable->SetDescriptors(0, numDescriptors, pDescriptors);
+	entry.Table = descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get());
+	if (!entry.Table) return entry.Table;
+
+	// Evict the least recently used table, e.g., of the targets no longer bound
+	if (it == m_tableCache.cend() && m_tableCache.size() >= MaxCachedTables)
+		m_tableCache.erase(min_element(m_tableCache.cbegin(), m_tableCache.cend(),
+			[](const auto& a, const auto& b) { return a.second.LastUse < b.second.LastUse; }));
+	entry.LastUse = ++m_tableCacheClock;
+	m_tableCache[key] = entry;
+
+	return entry.Table;
+}
+
+bool SoftGraphicsPipeline::isDepthOnlyPipeline() const
+{
+	return m_numColorTargets == 0 && m_pDepth;
+}
+
+bool SoftGraphicsPipeline::isTiledPipeline() const
+{
+	// The tile-ordered raster keeps a single pass, so that the primitives stay in order.
+	// The depth-only pipeline needs no order, so it always takes the unordered raster.
+	return !isDepthOnlyPipeline() && (m_rasterMode == RASTER_TILE_ORDERED || m_blendMode != BLEND_OPAQUE);
+}
+
+bool SoftGraphicsPipeline::isTwoPassCulling(const CBViewPort& cbViewport) const
 {
-	if (!m_vertexCompletions)
+	// The unordered comparisons cannot reject against the farthest depths
+	return m_pDepth && m_occlusionCulling && !isTiledPipeline() && cbViewport.DepthFunc <= DEPTH_EQUAL;
+}
+
+void SoftGraphicsPipeline::clearHiZ(CommandList* pCommandList, const uint32_t* pClearValue)
+{
+	// The dirty rectangles cover the tiles and bins they touch, where the farther clear value
+	// of the partially covered ones only gives up culling
+	RectRange rects[MaxDirtyRects];
+	const auto pRects = m_numDirtyRects > 0 ? rects : nullptr;
+	const auto getRects = [this, &rects](uint8_t sizeLog)
+	{
+		const auto size = 1l << sizeLog;
+		for (auto i = 0u; i < m_numDirtyRects; ++i)
+			rects[i] = RectRange(m_dirtyRects[i].Left >> sizeLog, m_dirtyRects[i].Top >> sizeLog,
+				(m_dirtyRects[i].Right + size - 1) >> sizeLog, (m_dirtyRects[i].Bottom + size - 1) >> sizeLog);
+	};
+
+	getRects(m_tileSizeLog);
+	pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_numOutTables - 2],
+		m_pDepth->TileZ->GetUAV(), m_pDepth->TileZ.get(), pClearValue, m_numDirtyRects, pRects);
+	for (uint8_t i = 0; i < m_numBinLevels; ++i)
+	{
+		getRects(m_tileSizeLog + m_tileToBinLog * (i + 1));
+		pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_numOutTables - 3 - i],
+			m_pDepth->BinZ[i]->GetUAV(), m_pDepth->BinZ[i].get(), pClearValue, m_numDirtyRects, pRects);
+	}
+}
+
+void SoftGraphicsPipeline::assignTransients()
+{
+	// Each transient takes the first physical buffer of the same stride, of which no
+	// assigned transient is live in a same phase of a same raster mode
+	for (uint8_t i = 0; i < NUM_TRANSIENT; ++i)
+	{
+		const auto& info = TransientInfos[i];
+		uint8_t slot = 0;
+		for (; slot < i; ++slot)
+		{
+			auto isUsed = false;
+			auto isFree = true;
+			for (uint8_t j = 0; j < i && isFree; ++j)
+			{
+				if (m_transientSlots[j] != slot) continue;
+				const auto& other = TransientInfos[j];
+				isUsed = true;
+				isFree = other.Stride == info.Stride &&
+					!((other.Phases & info.Phases) && (other.RasterModes & info.RasterModes));
+			}
+
+			if (isUsed && isFree) break;
+		}
+
+		m_transientSlots[i] = slot;
+	}
+}
+
+void SoftGraphicsPipeline::decayBuffers()
+{
+	// The buffers decay to the common state after the command lists of the previous frames,
+	// and are promoted implicitly on their first accesses in this frame
+	Resource* const pBuffers[] =
+	{
+		m_vertexPos.get(),
+		m_primDrawIds.get(),
+		m_culledRecords.get(),
+		m_drawArgs.get(),
+		m_rejectedObjects.get(),
+		m_tilePrimCount.get(),
+		m_tilePrimitives.get(),
+		m_tileListRanges.get(),
+		m_areaHistogram.get(),
+		m_rejectedCount.get(),
+		m_rejectedArgs.get()
+	};
+	for (const auto pBuffer : pBuffers) if (pBuffer) pBuffer->Transition(ResourceState::COMMON);
+	for (const auto& attrib : m_vertexAttribs) if (attrib) attrib->Transition(ResourceState::COMMON);
+	for (const auto& binPrimCount : m_binPrimCounts) if (binPrimCount) binPrimCount->Transition(ResourceState::COMMON);
+	for (const auto& buffer : m_physicalTransients) if (buffer) buffer->Transition(ResourceState::COMMON);
+	m_uavAccesses.clear();
+}
+
+void SoftGraphicsPipeline::transition(CommandList* pCommandList, uint32_t numAccesses,
+	const BufferAccess* pAccesses, uint32_t numBarriers)
+{
+	// A stage needs the barriers on the state changes, and the UAV barriers on the hazards
+	// with the unordered accesses of the earlier stages, all in one batch
+	const auto barriers = m_barriers.data();
+	for (auto i = 0u; i < numAccesses; ++i)
+	{
+		const auto& access = pAccesses[i];
+		const auto state = access.pBuffer->GetResourceState();
+		const auto pLast = find_if(m_uavAccesses.begin(), m_uavAccesses.end(),
+			[&access](const BufferAccess& uavAccess) { return uavAccess.pBuffer == access.pBuffer; });
+		const auto isPending = pLast != m_uavAccesses.end();
+
+		auto isOrdered = true;
+		if (state == ResourceState::COMMON) access.pBuffer->Transition(access.State);
+		else if (state != access.State || (isPending && (pLast->Type != access.Type || access.Type == ACCESS_WRITE)))
+			numBarriers = access.pBuffer->SetBarrier(barriers, access.State, numBarriers);
+		else isOrdered = false;
+
+		// Track the unordered accesses since the last barrier of each buffer
+		if (access.State != ResourceState::UNORDERED_ACCESS)
+		{
+			if (isPending)
+			{
+				*pLast = m_uavAccesses.back();
+				m_uavAccesses.pop_back();
+			}
+		}
+		else if (!isPending) m_uavAccesses.push_back(access);
+		else if (isOrdered) *pLast = access;
+	}
+
+	if (numBarriers > 0) pCommandList->Barrier(numBarriers, barriers);
+}
+
+bool SoftGraphicsPipeline::draw(CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws, StageIndex vs)
+{
+	// The records of the draws are appended to the ring of the frame, where each record
+	// holds the offset of its first output vertex within a view. The recorded draws of
+	// the frame still read their records, so the ring cannot be flushed within a frame.
+	const auto baseRecord = MAX_DRAW_RECORDS * m_frameIndex + m_numDrawRecords;
+	if (numDraws == 0) return true;
+	XUSG_M_RETURN(m_numDrawRecords + numDraws > MAX_DRAW_RECORDS, cerr,
+		"SoftGraphicsPipeline: more than MAX_DRAW_RECORDS draw records in a frame", false);
+
+	auto num = 0u;
+	for (auto i = 0u; i < numDraws; ++i)
+	{
+		auto& record = m_pDrawRecords[baseRecord + i];
+		record.NumVertices = pDraws[i].NumVertices / 3 * 3;
+		record.NumInstances = pDraws[i].NumInstances;
+		record.StartVertex = pDraws[i].StartVertex;
+		record.BaseVertex = pDraws[i].BaseVertex;
+		record.BaseInstance = pDraws[i].BaseInstance;
+		record.VertexOffset = num;
+		record.DrawId = i;
+		num += record.NumVertices * record.NumInstances;
+	}
+	m_numDrawRecords += numDraws;
+	if (num == 0) return true;
+
+	return drawRecords(pCommandList, num, numDraws, baseRecord, vs);
+}
+
+bool SoftGraphicsPipeline::drawRecords(CommandList* pCommandList, uint32_t num, uint32_t numDraws,
+	uint32_t baseRecord, StageIndex vs, const CBCull* pCbCull)
+{
+	// The vertices are processed once per instance and view, and the buffers grow on demand
+	const auto numOutVertices = num * m_numViews;
+	if (!m_vertexCompletions || numOutVertices > m_maxVertexCount)
 	{
+		// The draws recorded earlier still refer to the replaced buffers until the frames in flight complete
+		auto& retiredBuffers = m_retiredBuffers[m_frameIndex];
+		if (m_vertexPos) retiredBuffers.push_back(move(m_vertexPos));
+		if (m_primDrawIds) retiredBuffers.push_back(move(m_primDrawIds));
+		if (m_vertexCompletions) retiredBuffers.push_back(move(m_vertexCompletions));
+		for (auto& attrib : m_vertexAttribs) if (attrib) retiredBuffers.push_back(move(attrib));
+
 		const auto pDevice = pCommandList->GetDevice();
+		const auto maxVertexCount = m_maxVertexCount = (max)(m_maxVertexCount, numOutVertices);
 		m_vertexPos = StructuredBuffer::MakeUnique();
-		m_vertexPos->Create(pDevice, m_maxVertexCount, sizeof(float[4]),
+		m_vertexPos->Create(pDevice, maxVertexCount, sizeof(float[4]),
 			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
 			1, nullptr, 1, nullptr, MemoryFlag::NONE, L"VertexPositions");
 
+		m_primDrawIds = StructuredBuffer::MakeUnique();
+		m_primDrawIds->Create(pDevice, XUSG_DIV_UP(maxVertexCount, 3), sizeof(uint32_t),
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+			1, nullptr, 1, nullptr, MemoryFlag::NONE, L"PrimitiveDrawIDs");
+
+		XUSG_N_RETURN(createTransient(pDevice, TRANSIENT_REJECTED_PRIMS, XUSG_DIV_UP(maxVertexCount, 3)), false);
+
 		m_vertexCompletions = StructuredBuffer::MakeUnique();
-		m_vertexCompletions->Create(pDevice, m_maxVertexCount, sizeof(uint32_t),
+		m_vertexCompletions->Create(pDevice, maxVertexCount, sizeof(uint32_t),
 			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
 			1, nullptr, 1, nullptr, MemoryFlag::NONE, L"VertexCompletions");
 
@@ -465,106 +1596,454 @@ void SoftGraphicsPipeline::draw(CommandList* pCommandList, uint32_t num, StageIn
 		for (auto i = 0u; i < attribCount; ++i)
 		{
 			m_vertexAttribs[i] = TypedBuffer::MakeUnique();
-			m_vertexAttribs[i]->Create(pDevice, m_maxVertexCount, m_attribInfo[i].Stride,
+			m_vertexAttribs[i]->Create(pDevice, maxVertexCount, m_attribInfo[i].Stride,
 				m_attribInfo[i].Format, ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
 				1, nullptr, 1, nullptr, MemoryFlag::NONE, m_attribInfo[i].Name.c_str());
 		}
 
-		createPipelines();
+		// The tile-ordered raster refers to the attributes in its own table
+		m_maxTileCount = 0;
+		m_isTableDirty = true;
+		m_vertexHash = 0;
+	}
+
+	// (Re)create the pipelines, e.g., on the changes of the tile sizes, if not compiled in advance,
+	// where the draws fail without retrying a failed compilation of the same settings
+	if (!m_isCompiled)
+	{
+		if (m_isCompileFailed) return false;
+		m_isCompileFailed = !Compile();
+		XUSG_N_RETURN(!m_isCompileFailed, false);
+	}
+	if (m_isPipelineDirty || m_isTableDirty)
+	{
 		createDescriptorTables();
 
 		SetDecriptorHeaps(pCommandList);
+		m_isPipelineDirty = false;
+		m_isTableDirty = false;
 	}
 
+	// The depth-only pipeline skips the attributes
+	if (isDepthOnlyPipeline()) vs = vs == VERTEX_INDEXED ? VERTEX_INDEXED_DEPTH : VERTEX_DEPTH;
+
+	// The same draw as the only one of the previous frame reuses its depth and tile primitives,
+	// if all of them are resident, i.e., not only the re-tested ones of occlusion culling
+	const auto drawHash = pCbCull ? 0 : hashStaticDraw(num, numDraws, baseRecord, vs);
+	const auto isStatic = drawHash != 0 && drawHash == m_lastDrawHash;
+	const auto isReused = isStatic && m_isLastDrawResident;
+	m_drawHash = drawHash;
+	m_isDrawResident = false;
+	if (isReused) m_clearDepth = 0xffffffff;
+
+	// Before the clear, PixelZ still holds the depth of the previous frame for the first pass of occlusion
+	// culling, which the tile-ordered raster skips
+	if (m_pDepth && m_occlusionCulling && !isTiledPipeline() && !isReused) BuildDepthPyramid(pCommandList);
+
 	// Clear depth
 	if (m_pDepth && m_clearDepth != 0xffffffff)
 	{
-		pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_outTables.size() - 1],
-			m_pDepth->PixelZ->GetUAV(), m_pDepth->PixelZ.get(), &m_clearDepth);
-		pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_outTables.size() - 2],
-			m_pDepth->TileZ->GetUAV(), m_pDepth->TileZ.get(), &m_clearDepth);
-#if USE_TRIPPLE_RASTER
-		pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_outTables.size() - 3],
-			m_pDepth->BinZ->GetUAV(), m_pDepth->BinZ.get(), &m_clearDepth);
-#endif
+		const auto clearDepth = m_clearDepth ^ m_depthFlip;
+		pCommandList->ClearUnorderedAccessViewUint(m_outTables[m_numOutTables - 1],
+			m_pDepth->PixelZ->GetUAV(), m_pDepth->PixelZ.get(), &clearDepth, m_numDirtyRects, m_dirtyRects);
+		clearHiZ(pCommandList, &clearDepth);
 		m_clearDepth = 0xffffffff;
 	}
 
-	// Set resource barriers and clear
+	// The unordered depth writes may push the depth farther, so the Hi-Z gives up culling
+	if (m_pDepth && m_depthWrite && (m_depthFunc == ComparisonFunc::NOT_EQUAL || m_depthFunc == ComparisonFunc::ALWAYS))
+	{
+		const uint32_t clearHiZValue = 0xffffffff;
+		clearHiZ(pCommandList, &clearHiZValue);
+	}
+
+	// Set resource barriers and clear, only within the dirty rectangles if any
 	ResourceBarrier barrier;
 	// Due to auto promotions, no need to call commandList.Barrier()
-	const uint32_t clearCount = static_cast<uint32_t>(m_clears.size());
-	for (auto i = 0u; i < clearCount; ++i)
+	for (auto i = 0u; i < m_numClears; ++i)
 	{
 		m_pColorTarget[i].SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
 		if (m_clears[i].IsUint)
 			pCommandList->ClearUnorderedAccessViewUint(m_outTables[i], m_clears[i].pTarget->GetUAV(),
-				m_clears[i].pTarget, m_clears[i].ClearUint);
+				m_clears[i].pTarget, m_clears[i].ClearUint, m_numDirtyRects, m_dirtyRects);
 		else pCommandList->ClearUnorderedAccessViewFloat(m_outTables[i], m_clears[i].pTarget->GetUAV(),
-			m_clears[i].pTarget, m_clears[i].ClearFloat);
+			m_clears[i].pTarget, m_clears[i].ClearFloat, m_numDirtyRects, m_dirtyRects);
 	}
-	m_clears.clear();
+	m_numClears = 0;
 
-	m_tilePrimCount->SetBarrier(&barrier, ResourceState::COPY_DEST);
-#if USE_TRIPPLE_RASTER
-	m_binPrimCount->SetBarrier(&barrier, ResourceState::COPY_DEST);
-#endif
-	for (auto& attrib : m_vertexAttribs)
-		attrib->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
+	// Nothing passes the depth test
+	if (m_pDepth && m_depthFunc == ComparisonFunc::NEVER) return true;
 
-	// Vertex shader
+	// Each dirty rectangle narrows the scissor rectangle of its own raster, so that the bin raster
+	// rejects the primitives outside, and nothing is drawn if the scissor rectangle is empty
+	const auto numRects = (max)(m_numDirtyRects, 1u);
+	CBViewPort cbViewports[MaxDirtyRects];
+	auto numViewports = 0u;
+	for (auto r = 0u; r < numRects; ++r)
 	{
-		// Set descriptor tables
-		const auto baseIdx = static_cast<uint32_t>(m_extVsTables.size());
-		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[vs]);
-		for (auto i = 0u; i < baseIdx; ++i)
-			pCommandList->SetComputeDescriptorTable(i, m_extVsTables[i]);
-		pCommandList->SetComputeDescriptorTable(baseIdx, m_srvTables[SRV_TABLE_VS]);
-		pCommandList->SetComputeDescriptorTable(baseIdx + 1, m_uavTables[UAV_TABLE_VS]);
+		auto scissorRect = m_scissorRect;
+		if (m_numDirtyRects > 0)
+		{
+			scissorRect.Left = (max)(scissorRect.Left, m_dirtyRects[r].Left);
+			scissorRect.Top = (max)(scissorRect.Top, m_dirtyRects[r].Top);
+			scissorRect.Right = (min)(scissorRect.Right, m_dirtyRects[r].Right);
+			scissorRect.Bottom = (min)(scissorRect.Bottom, m_dirtyRects[r].Bottom);
+		}
+		if (computeViewport(cbViewports[numViewports], num / 3, scissorRect)) ++numViewports;
+	}
+	if (numViewports == 0) return true;
 
-		// Set pipeline state
-		pCommandList->SetPipelineState(m_pipelines[vs]);
+	if (pCbCull)
+	{
+		// The objects are culled against the frustum, and against the depth pyramid of the previous
+		// frame with occlusion culling, whose rejected ones are re-tested after the first pass.
+		// The depth pyramid covers the first view only. The two passes of the objects replace the
+		// ones of the primitives, so the pyramid is built and the primitives rasterized once a pass.
+		// The objects are culled and their vertices processed once a pass within the whole scissor
+		// rectangle, and only the rasterizations are repeated for the dirty rectangles.
+		CBViewPort cbCullViewport;
+		computeViewport(cbCullViewport, num / 3, m_scissorRect);
+		auto cbCull = *pCbCull;
+		const auto isTwoPass = isTwoPassCulling(cbCullViewport) && m_numViews == 1;
+		const auto numPasses = isTwoPass ? 2u : 1u;
+		for (auto p = 0u; p < numPasses; ++p)
+		{
+			if (p > 0) BuildDepthPyramid(pCommandList);
+			cbCull.CullPass = isTwoPass ? p + 1 : 0;
+			cullDraws(pCommandList, cbCullViewport, cbCull);
+			processVertices(pCommandList, num, numDraws, baseRecord, vs, true);
+			for (auto r = 0u; r < numViewports; ++r)
+				XUSG_N_RETURN(rasterizer(pCommandList, cbViewports[r], true, isTwoPass), false);
+		}
+
+		return true;
+	}
+
+	// The vertices of the direct draws are processed only once for all the dirty rectangles
+	auto isVertexProcessed = false;
+	for (auto r = 0u; r < numViewports; ++r)
+	{
+		const auto& cbViewport = cbViewports[r];
+		if (isReused)
+		{
+			// Only re-shade the front-most fragments of the resident tile primitives with the equal
+			// test, e.g., for the changes of the lighting, where the vertex outputs are also reused
+			auto cbShade = cbViewport;
+			cbShade.DepthFunc = DEPTH_EQUAL;
+			cbShade.DepthWrite = 0;
+			processVertices(pCommandList, num, numDraws, baseRecord, vs, false);
+			pixelPass(pCommandList, cbShade, false, false);
+			m_isDrawResident = true;
+		}
+		else
+		{
+			if (!isVertexProcessed) processVertices(pCommandList, num, numDraws, baseRecord, vs, false);
+			isVertexProcessed = true;
+
+			// Rasterizations, where the draws and instances of a view are consecutive in the primitive IDs,
+			// and a static draw rasterizes in a single pass to keep all its tile primitives
+			XUSG_N_RETURN(rasterizer(pCommandList, cbViewport, false, isStatic), false);
+			m_isDrawResident = drawHash != 0 && (isStatic || !isTwoPassCulling(cbViewport));
+		}
+	}
+
+	return true;
+}
+
+void SoftGraphicsPipeline::cullDraws(CommandList* pCommandList, const CBViewPort& cbViewport, const CBCull& cbCull)
+{
+	// The indirect arguments set the draw count of the vertex stage and the drawn primitive
+	// count of the bin raster, which depend on the pipeline layouts
+	if (!m_vsCommandLayout && !createDrawCommandLayouts(pCommandList->GetDevice())) return;
+
+	// Reset the rejected object count in the first pass
+	if (cbCull.CullPass == 1)
+	{
+		const BufferAccess reset = { m_rejectedObjects.get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+		transition(pCommandList, 1, &reset);
+		pCommandList->CopyBufferRegion(m_rejectedObjects.get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
+	}
+
+	// Set resource barriers, the re-test pass reads the rejected objects
+	const BufferAccess accesses[] =
+	{
+		{ m_culledRecords.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE },
+		{ m_drawArgs.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE },
+		{ m_rejectedObjects.get(), ResourceState::UNORDERED_ACCESS, cbCull.CullPass > 1 ? ACCESS_READ : ACCESS_APPEND }
+	};
+	transition(pCommandList, static_cast<uint32_t>(size(accesses)), accesses);
+
+	// Set descriptor tables
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[DRAW_CULL]);
+	pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
+	pCommandList->SetCompute32BitConstants(1, XUSG_UINT32_SIZE_OF(cbCull), &cbCull);
+	pCommandList->SetComputeDescriptorTable(2, m_srvTables[SRV_TABLE_CULL]);
+	if (m_pDepth) pCommandList->SetComputeDescriptorTable(3, m_srvTables[SRV_TABLE_PYRAMID]);
+	pCommandList->SetComputeDescriptorTable(4, m_uavTables[UAV_TABLE_CULL]);
+
+	// Set pipeline state
+	pCommandList->SetPipelineState(m_pipelines[DRAW_CULL]);
+
+	// Dispatch a single group, which compacts the visible objects in order
+	pCommandList->Dispatch(1, 1, 1);
+}
+
+void SoftGraphicsPipeline::processVertices(CommandList* pCommandList, uint32_t num, uint32_t numDraws,
+	uint32_t baseRecord, StageIndex vs, bool isIndirect)
+{
+	// The outputs of the same direct draws with the same inputs are still valid, e.g., on the
+	// static frames, where the depth-only variants also reuse the outputs with the attributes
+	const auto isDepthOnly = vs == VERTEX_DEPTH || vs == VERTEX_INDEXED_DEPTH;
+	const auto vertexHash = isIndirect ? 0 : hashVertexInputs(num, numDraws, baseRecord, vs);
+
+	// The outputs of a single draw are kept, so the other draws of the frame would evict them
+	assert(vertexHash == 0 || m_frameVertexHash == 0 || vertexHash == m_frameVertexHash);
+	if (vertexHash != 0) m_frameVertexHash = vertexHash;
+	if (vertexHash != 0 && vertexHash == m_vertexHash && (isDepthOnly || m_hasVertexAttribs)) return;
+	m_vertexHash = vertexHash;
+	m_hasVertexAttribs = !isDepthOnly;
+
+	// Set resource barriers, the indirect draws read the culled records
+	const auto accesses = m_accesses.data();
+	auto numAccesses = 0u;
+	if (isIndirect)
+	{
+		accesses[numAccesses++] = { m_culledRecords.get(), ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+		accesses[numAccesses++] = { m_drawArgs.get(), ResourceState::INDIRECT_ARGUMENT, ACCESS_READ };
+	}
+	accesses[numAccesses++] = { m_vertexPos.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	accesses[numAccesses++] = { m_primDrawIds.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	if (!isDepthOnlyPipeline())
+		for (auto& attrib : m_vertexAttribs)
+			accesses[numAccesses++] = { attrib.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	transition(pCommandList, numAccesses, accesses);
+
+	// Set descriptor tables
+	const auto baseIdx = static_cast<uint32_t>(m_extVsTables.size());
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[vs]);
+	for (auto i = 0u; i < baseIdx; ++i)
+		pCommandList->SetComputeDescriptorTable(i, m_extVsTables[i]);
+	pCommandList->SetComputeDescriptorTable(baseIdx, m_srvTables[SRV_TABLE_VS]);
+	pCommandList->SetComputeDescriptorTable(baseIdx + 1, m_uavTables[UAV_TABLE_VS]);
+
+	// Each thread fetches a vertex of an instance of a draw once, and broadcasts it to the views
+	const uint32_t cbDraws[] = { num, numDraws, baseRecord, m_numViews };
+	pCommandList->SetCompute32BitConstants(baseIdx + 2, static_cast<uint32_t>(size(cbDraws)), cbDraws);
+
+	// Set pipeline state
+	pCommandList->SetPipelineState(m_pipelines[vs]);
+
+	// Dispatch over the vertices of all the draws and instances, or over the ones
+	// of the visible draws, where the draw count is set by the indirect arguments.
+	// The groups are laid out in rows, so that the large draws fit the dispatch limits.
+	if (isIndirect) pCommandList->ExecuteIndirect(m_vsCommandLayout.get(), 1, m_drawArgs.get());
+	else
+	{
+		const auto numGroups = XUSG_DIV_UP(num, 64);
+		pCommandList->Dispatch((min)(numGroups, static_cast<uint32_t>(VERTEX_GROUP_ROW)),
+			XUSG_DIV_UP(numGroups, VERTEX_GROUP_ROW), 1);
+	}
+}
+
+uint64_t SoftGraphicsPipeline::hashVertexInputs(uint32_t num, uint32_t numDraws, uint32_t baseRecord, StageIndex vs) const
+{
+	// The caller hashes the data behind the descriptor tables, without which nothing is reused
+	if (m_vsDataHash == 0) return 0;
+
+	const uint32_t params[] = { num, numDraws, m_numViews, vs == VERTEX_INDEXED || vs == VERTEX_INDEXED_DEPTH };
+	auto hash = Hash(params, sizeof(params), m_vsDataHash);
+	hash = Hash(&m_vertexBufferView, sizeof(m_vertexBufferView), hash);
+	hash = Hash(&m_indexBufferView, sizeof(m_indexBufferView), hash);
+
+	// The records differ in the frames only by their places in the ring
+	hash = Hash(&m_pDrawRecords[baseRecord], sizeof(DrawRecord) * numDraws, hash);
+
+	return hash != 0 ? hash : 1;
+}
 
-		// Dispatch
-		pCommandList->Dispatch(XUSG_DIV_UP(num, 64), 1, 1);
+uint64_t SoftGraphicsPipeline::hashStaticDraw(uint32_t num, uint32_t numDraws, uint32_t baseRecord, StageIndex vs) const
+{
+	// Only the first draw into the cleared depth, with the ordered test and without blending,
+	// leaves the depth of the frame, whose front-most fragments are found by the equal test.
+	// The tile primitives of multiple dirty rectangles are not resident together.
+	if (!m_pDepth || m_clearDepth == 0xffffffff || !m_depthWrite || isDepthOnlyPipeline() || isTiledPipeline()) return 0;
+	if (m_numDirtyRects > 1) return 0;
+	switch (m_depthFunc)
+	{
+	case ComparisonFunc::LESS:
+	case ComparisonFunc::LESS_EQUAL:
+	case ComparisonFunc::GREATER:
+	case ComparisonFunc::GREATER_EQUAL:
+		break;
+	default:
+		return 0;
 	}
 
-	// Rasterizations
-	rasterizer(pCommandList, num / 3);
+	const auto vertexHash = hashVertexInputs(num, numDraws, baseRecord, vs);
+	if (vertexHash == 0) return 0;
+
+	const uint32_t params[] =
+	{
+		m_clearDepth, m_depthFlip, static_cast<uint32_t>(m_depthFunc), m_tileSizeLog,
+		m_tileToBinLog, m_numBinLevels, m_viewColumns, m_features
+	};
+	auto hash = Hash(params, sizeof(params), vertexHash);
+	hash = Hash(&m_viewport, sizeof(m_viewport), hash);
+	hash = Hash(&m_scissorRect, sizeof(m_scissorRect), hash);
+	hash = Hash(m_dirtyRects, sizeof(RectRange) * m_numDirtyRects, hash);
+	hash = Hash(&m_pDepth, sizeof(m_pDepth), hash);
+
+	return hash != 0 ? hash : 1;
 }
 
-void SoftGraphicsPipeline::rasterizer(CommandList* pCommandList, uint32_t numTriangles)
+bool SoftGraphicsPipeline::computeViewport(CBViewPort& cbViewport, uint32_t numTriangles, const RectRange& scissorRect) const
 {
-	CBViewPort cbViewport;
 	cbViewport.TopLeftX = m_viewport.TopLeftX;
 	cbViewport.TopLeftY = m_viewport.TopLeftY;
 	cbViewport.Width = m_viewport.Width;
 	cbViewport.Height = m_viewport.Height;
-	cbViewport.NumTileX = static_cast<uint32_t>(ceil(cbViewport.Width / TILE_SIZE));
-	cbViewport.NumTileY = static_cast<uint32_t>(ceil(cbViewport.Height / TILE_SIZE));
-	cbViewport.NumBinX = static_cast<uint32_t>(ceil(cbViewport.Width / BIN_SIZE));
-	cbViewport.NumBinY = static_cast<uint32_t>(ceil(cbViewport.Height / BIN_SIZE));
+
+	// The tile grids start from the target origin, and cover the views with the offsets,
+	// where the views are laid out in a grid of the viewport sizes
+	const auto numViewRows = XUSG_DIV_UP(m_numViews, m_viewColumns);
+	const auto right = cbViewport.TopLeftX + cbViewport.Width * m_viewColumns;
+	const auto bottom = cbViewport.TopLeftY + cbViewport.Height * numViewRows;
+	const auto tileSize = static_cast<float>(1 << m_tileSizeLog);
+	const auto binSize = static_cast<float>(1 << (m_tileSizeLog + m_tileToBinLog));
+	cbViewport.NumTileX = static_cast<uint32_t>(ceil(right / tileSize));
+	cbViewport.NumTileY = static_cast<uint32_t>(ceil(bottom / tileSize));
+	cbViewport.NumBinX = static_cast<uint32_t>(ceil(right / binSize));
+	cbViewport.NumBinY = static_cast<uint32_t>(ceil(bottom / binSize));
+
+	// The scissor rectangle is clipped by the views, and nothing is drawn if empty
+	cbViewport.ScissorLeft = static_cast<uint32_t>((max)(scissorRect.Left, static_cast<long>(cbViewport.TopLeftX)));
+	cbViewport.ScissorTop = static_cast<uint32_t>((max)(scissorRect.Top, static_cast<long>(cbViewport.TopLeftY)));
+	cbViewport.ScissorRight = static_cast<uint32_t>((min)(scissorRect.Right, static_cast<long>(ceil(right))));
+	cbViewport.ScissorBottom = static_cast<uint32_t>((min)(scissorRect.Bottom, static_cast<long>(ceil(bottom))));
+	if (cbViewport.ScissorLeft >= cbViewport.ScissorRight || cbViewport.ScissorTop >= cbViewport.ScissorBottom) return false;
+	cbViewport.NumViewPrims = (max)(numTriangles, 1u);
+	cbViewport.NumDrawPrims = cbViewport.NumViewPrims;	// Set by the indirect arguments after the GPU culling
+	cbViewport.ViewColumns = m_viewColumns;
+	cbViewport.Blend = m_blendMode;
+	cbViewport.ShadingRateLog = m_shadingRate;
+	cbViewport.HasRateImage = m_pRateImage ? 1 : 0;
+
+	// The default threshold is 4x4 tile sizes, before any area feedback
+	cbViewport.BinThreshold = m_binThreshold > 0.0f ? m_binThreshold : tileSize * tileSize * 16.0f;
+	cbViewport.NumBinLevels = m_numBinLevels;
+	cbViewport.RefineSizeLog = m_tileSizeLog;
+	cbViewport.OcclusionPass = 0;
+	cbViewport.DepthFlip = m_depthFlip;
+	cbViewport.DepthWrite = m_depthWrite;
+
+	// Comparisons of the depth keys, of which the smaller is the nearer
+	switch (m_depthFunc)
+	{
+	case ComparisonFunc::LESS:
+	case ComparisonFunc::GREATER:
+		cbViewport.DepthFunc = DEPTH_LESS;
+		break;
+	case ComparisonFunc::EQUAL:
+		cbViewport.DepthFunc = DEPTH_EQUAL;
+		break;
+	case ComparisonFunc::NOT_EQUAL:
+		cbViewport.DepthFunc = DEPTH_NOT_EQUAL;
+		break;
+	case ComparisonFunc::ALWAYS:
+		cbViewport.DepthFunc = DEPTH_ALWAYS;
+		break;
+	default:
+		cbViewport.DepthFunc = DEPTH_LESS_EQUAL;
+	}
+
+	return true;
+}
+
+bool SoftGraphicsPipeline::rasterizer(CommandList* pCommandList, const CBViewPort& cbViewport,
+	bool isIndirect, bool isSinglePass)
+{
+	const auto isTiled = isTiledPipeline();
+	const auto numTriangles = cbViewport.NumViewPrims * m_numViews;
+	auto cbRaster = cbViewport;
+	if (!isSinglePass && isTwoPassCulling(cbViewport))
+	{
+		// First pass, culling against the depth pyramid of the previous frame
+		cbRaster.OcclusionPass = 1;
+		XUSG_N_RETURN(rasterPass(pCommandList, cbRaster, numTriangles, isTiled, isIndirect), false);
+
+		// Second pass, re-testing the rejected primitives against the depth pyramid of the first pass
+		BuildDepthPyramid(pCommandList);
+		cbRaster.OcclusionPass = 2;
+	}
+
+	return rasterPass(pCommandList, cbRaster, numTriangles, isTiled, isIndirect);
+}
+
+bool SoftGraphicsPipeline::rasterPass(CommandList* pCommandList, const CBViewPort& cbViewport,
+	uint32_t numTriangles, bool isTiled, bool isIndirect)
+{
+	const auto isRetest = cbViewport.OcclusionPass > 1;
+	const auto accesses = m_accesses.data();
+
+	// The counts are still the indirect arguments of the first pass in the re-test pass, and the
+	// first pass of occlusion culling also resets the rejected primitive count and the dispatch
+	// arguments of the re-test pass
+	auto numAccesses = 0u;
+	accesses[numAccesses++] = { m_tilePrimCount.get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+	for (uint8_t i = 0; i < m_numBinLevels; ++i)
+		accesses[numAccesses++] = { m_binPrimCounts[i].get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+	if (m_isHistogramDirty)
+		accesses[numAccesses++] = { m_areaHistogram.get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+	if (cbViewport.OcclusionPass == 1)
+	{
+		accesses[numAccesses++] = { m_rejectedCount.get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+		accesses[numAccesses++] = { m_rejectedArgs.get(), ResourceState::COPY_DEST, ACCESS_WRITE };
+	}
+	transition(pCommandList, numAccesses, accesses);
 
 	// Reset TilePrimitiveCount
 	pCommandList->CopyBufferRegion(m_tilePrimCount.get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
-#if USE_TRIPPLE_RASTER
-	// Reset BinPrimitiveCount
-	pCommandList->CopyBufferRegion(m_binPrimCount.get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
-#endif
 
-	// Set resource barriers
-	vector<ResourceBarrier> barriers(m_vertexAttribs.size() + 2);
-	auto numBarriers = m_tilePrimCount->SetBarrier(barriers.data(), ResourceState::UNORDERED_ACCESS);
-#if USE_TRIPPLE_RASTER
-	numBarriers = m_binPrimCount->SetBarrier(barriers.data(), ResourceState::UNORDERED_ACCESS, numBarriers);
-#endif
-	pCommandList->Barrier(numBarriers, barriers.data());
+	// Reset BinPrimitiveCounts
+	for (uint8_t i = 0; i < m_numBinLevels; ++i)
+		pCommandList->CopyBufferRegion(m_binPrimCounts[i].get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
 
-	// Due to auto promotions, no need to call commandList.Barrier()
-	m_tilePrimitives->SetBarrier(barriers.data(), ResourceState::UNORDERED_ACCESS);
-#if USE_TRIPPLE_RASTER
-	m_binPrimitives->SetBarrier(barriers.data(), ResourceState::UNORDERED_ACCESS);
-#endif
+	// Reset the area histogram at the first draw of the frame
+	if (m_isHistogramDirty)
+	{
+		pCommandList->CopyBufferRegion(m_areaHistogram.get(), 0, m_areaHistogramReset.get(),
+			0, sizeof(uint32_t[AREA_HISTOGRAM_SIZE]));
+		m_isHistogramDirty = false;
+	}
+
+	if (cbViewport.OcclusionPass == 1)
+	{
+		pCommandList->CopyBufferRegion(m_rejectedCount.get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
+		pCommandList->CopyBufferRegion(m_rejectedArgs.get(), 0, m_tilePrimCountReset.get(), 0, sizeof(uint32_t));
+	}
+
+	// Set resource barriers, the bin raster appends to all the levels and to the tiles
+	numAccesses = 0;
+	accesses[numAccesses++] = { m_vertexPos.get(), ResourceState::UNORDERED_ACCESS, ACCESS_READ };
+	accesses[numAccesses++] = { m_tilePrimCount.get(), ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+	accesses[numAccesses++] = { m_tilePrimitives.get(), ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+	for (uint8_t i = 0; i < m_numBinLevels; ++i)
+	{
+		accesses[numAccesses++] = { m_binPrimCounts[i].get(), ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+		accesses[numAccesses++] = { m_transients[TRANSIENT_BIN_PRIMS + i], ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+	}
+	accesses[numAccesses++] = { m_areaHistogram.get(), ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+	if (isIndirect) accesses[numAccesses++] = { m_drawArgs.get(), ResourceState::INDIRECT_ARGUMENT, ACCESS_READ };
+	if (cbViewport.OcclusionPass > 0)
+	{
+		const auto rejectedAccess = isRetest ? ACCESS_READ : ACCESS_APPEND;
+		accesses[numAccesses++] = { m_rejectedCount.get(), ResourceState::UNORDERED_ACCESS, rejectedAccess };
+		accesses[numAccesses++] = { m_transients[TRANSIENT_REJECTED_PRIMS], ResourceState::UNORDERED_ACCESS, rejectedAccess };
+		accesses[numAccesses++] = isRetest ?
+			BufferAccess{ m_rejectedArgs.get(), ResourceState::INDIRECT_ARGUMENT, ACCESS_READ } :
+			BufferAccess{ m_rejectedArgs.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	}
+	transition(pCommandList, numAccesses, accesses);
 
 	// Bin raster
 	{
@@ -572,59 +2051,195 @@ void SoftGraphicsPipeline::rasterizer(CommandList* pCommandList, uint32_t numTri
 		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[BIN_RASTER]);
 		pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
 		pCommandList->SetComputeDescriptorTable(1, m_uavTables[UAV_TABLE_RS]);
+		if (m_pDepth) pCommandList->SetComputeDescriptorTable(2, m_srvTables[SRV_TABLE_PYRAMID]);
 
 		// Set pipeline state
 		pCommandList->SetPipelineState(m_pipelines[BIN_RASTER]);
 
-		// Dispatch
-		pCommandList->Dispatch(XUSG_DIV_UP(numTriangles, 64), 1, 1);
+		// Dispatch, or dispatch indirect over the rejected primitives, or over the primitives
+		// of the visible draws, where the drawn primitive count is set by the indirect arguments
+		if (isRetest) pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_rejectedArgs.get(), 0, m_rejectedArgs.get());
+		else if (isIndirect) pCommandList->ExecuteIndirect(m_binCommandLayout.get(), 1, m_drawArgs.get(), sizeof(uint32_t[4]));
+		else pCommandList->Dispatch(XUSG_DIV_UP(numTriangles, 64), 1, 1);
 	}
 
-#if USE_TRIPPLE_RASTER
-	// Set resource barriers
-	numBarriers = m_binPrimCount->SetBarrier(barriers.data(), ResourceState::INDIRECT_ARGUMENT);
-	numBarriers = m_binPrimitives->SetBarrier(barriers.data(), ResourceState::NON_PIXEL_SHADER_RESOURCE, numBarriers);
-	pCommandList->Barrier(numBarriers, barriers.data());
-
-	// Tile raster
+	// Tile raster, refining the bin levels from the coarsest one down to the tiles,
+	// and each pass appends to the lists of the next finer level
+	for (auto i = m_numBinLevels; i-- > 0;)
 	{
+		// Set resource barriers
+		numAccesses = 0;
+		accesses[numAccesses++] = { m_binPrimCounts[i].get(), ResourceState::INDIRECT_ARGUMENT, ACCESS_READ };
+		accesses[numAccesses++] = { m_transients[TRANSIENT_BIN_PRIMS + i], ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+		accesses[numAccesses++] = { m_vertexPos.get(), ResourceState::UNORDERED_ACCESS, ACCESS_READ };
+		accesses[numAccesses++] = { i > 0 ? m_binPrimCounts[i - 1].get() : m_tilePrimCount.get(),
+			ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+		accesses[numAccesses++] = { i > 0 ? m_transients[TRANSIENT_BIN_PRIMS + i - 1] : m_tilePrimitives.get(),
+			ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+		transition(pCommandList, numAccesses, accesses);
+
+		// The parent level is seen as the bins, and the child level is seen as the tiles
+		const auto childSizeLog = m_tileSizeLog + m_tileToBinLog * i;
+		const auto childScale = 1u << (m_tileToBinLog * i);
+		const auto parentScale = childScale << m_tileToBinLog;
+		auto cbRefine = cbViewport;
+		cbRefine.NumTileX = XUSG_DIV_UP(cbViewport.NumTileX, childScale);
+		cbRefine.NumTileY = XUSG_DIV_UP(cbViewport.NumTileY, childScale);
+		cbRefine.NumBinX = XUSG_DIV_UP(cbViewport.NumTileX, parentScale);
+		cbRefine.NumBinY = XUSG_DIV_UP(cbViewport.NumTileY, parentScale);
+		cbRefine.RefineSizeLog = childSizeLog;
+
 		// Set descriptor tables
 		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[TILE_RASTER]);
-		pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
-		pCommandList->SetComputeDescriptorTable(1, m_srvTables[SRV_TABLE_TR]);
-		pCommandList->SetComputeDescriptorTable(2, m_uavTables[UAV_TABLE_RS]);
+		pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbRefine), &cbRefine);
+		pCommandList->SetComputeDescriptorTable(1, m_srvTables[SRV_TABLE_TR + i]);
+		pCommandList->SetComputeDescriptorTable(2, m_uavTables[UAV_TABLE_TR + i]);
 
 		// Set pipeline state
 		pCommandList->SetPipelineState(m_pipelines[TILE_RASTER]);
 
 		// Dispatch indirect
-		pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_binPrimCount.get(), 0, m_binPrimCount.get());
+		pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_binPrimCounts[i].get(), 0, m_binPrimCounts[i].get());
 	}
-#endif
 
-	// Set resource barriers
-	numBarriers = m_tilePrimCount->SetBarrier(barriers.data(), ResourceState::INDIRECT_ARGUMENT);
-	numBarriers = m_tilePrimitives->SetBarrier(barriers.data(), ResourceState::NON_PIXEL_SHADER_RESOURCE, numBarriers);
-	for (auto& attrib : m_vertexAttribs)
-		numBarriers = attrib->SetBarrier(barriers.data(), ResourceState::NON_PIXEL_SHADER_RESOURCE, numBarriers);
-	pCommandList->Barrier(numBarriers, barriers.data());
+	// Sort the tile primitives into per-tile lists for the tile-ordered raster
+	if (isTiled) XUSG_N_RETURN(buildTileLists(pCommandList, cbViewport), false);
+
+	pixelPass(pCommandList, cbViewport, isTiled, !isRetest);
+
+	return true;
+}
+
+void SoftGraphicsPipeline::pixelPass(CommandList* pCommandList, const CBViewPort& cbViewport,
+	bool isTiled, bool isReadback)
+{
+	const auto isDepthOnly = isDepthOnlyPipeline();
+	const auto pixRaster = isTiled ? PIX_RASTER_TILED : (isDepthOnly ? PIX_RASTER_DEPTH : PIX_RASTER);
+	const auto accesses = m_accesses.data();
+
+	// Set resource barriers, where the area histogram is read back along with the transitions
+	auto numAccesses = 0u;
+	if (isTiled)
+	{
+		accesses[numAccesses++] = { m_transients[TRANSIENT_TILE_LISTS], ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+		accesses[numAccesses++] = { m_tileListRanges.get(), ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+	}
+	else
+	{
+		accesses[numAccesses++] = { m_tilePrimCount.get(), ResourceState::INDIRECT_ARGUMENT, ACCESS_READ };
+		accesses[numAccesses++] = { m_tilePrimitives.get(), ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+	}
+	accesses[numAccesses++] = { m_vertexPos.get(), ResourceState::UNORDERED_ACCESS, ACCESS_READ };
+	if (!isDepthOnly)
+	{
+		accesses[numAccesses++] = { m_primDrawIds.get(), ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+		for (auto& attrib : m_vertexAttribs)
+			accesses[numAccesses++] = { attrib.get(), ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+	}
+	if (m_pRateImage && !isTiled && !isDepthOnly)
+		accesses[numAccesses++] = { m_pRateImage, ResourceState::NON_PIXEL_SHADER_RESOURCE, ACCESS_READ };
+	if (isReadback) accesses[numAccesses++] = { m_areaHistogram.get(), ResourceState::COPY_SOURCE, ACCESS_READ };
+	transition(pCommandList, numAccesses, accesses);
+
+	// Read back the area histogram accumulated so far in this frame
+	if (isReadback)
+	{
+		const auto histogramSize = sizeof(uint32_t[AREA_HISTOGRAM_SIZE]);
+		pCommandList->CopyBufferRegion(m_areaHistogramReadback.get(), histogramSize * m_frameIndex,
+			m_areaHistogram.get(), 0, histogramSize);
+	}
 
 	// Pixel raster
+	if (isDepthOnly)
+	{
+		// Set descriptor tables, the depth-only raster writes PixelZ and TileZ only
+		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[pixRaster]);
+		pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
+		pCommandList->SetComputeDescriptorTable(1, m_srvTables[SRV_TABLE_PS]);
+		pCommandList->SetComputeDescriptorTable(2, m_uavTables[UAV_TABLE_RS]);
+		pCommandList->SetComputeDescriptorTable(3, m_outTables[m_numOutTables - 1]);
+
+		// Set pipeline state
+		pCommandList->SetPipelineState(m_pipelines[pixRaster]);
+
+		// Dispatch indirect
+		pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_tilePrimCount.get(), 0, m_tilePrimCount.get());
+	}
+	else
 	{
 		// Set descriptor tables
 		const auto baseIdx = static_cast<uint32_t>(m_extPsTables.size());
-		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[PIX_RASTER]);
+		pCommandList->SetComputePipelineLayout(m_pipelineLayouts[pixRaster]);
 		for (auto i = 0u; i < baseIdx; ++i)
 			pCommandList->SetComputeDescriptorTable(i, m_extPsTables[i]);
 		pCommandList->SetCompute32BitConstants(baseIdx, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
-		pCommandList->SetComputeDescriptorTable(baseIdx + 1, m_srvTables[SRV_TABLE_PS]);
+		pCommandList->SetComputeDescriptorTable(baseIdx + 1, m_srvTables[isTiled ? SRV_TABLE_PS_TILED : SRV_TABLE_PS]);
 		pCommandList->SetComputeDescriptorTable(baseIdx + 2, m_uavTables[UAV_TABLE_RS]);
 		pCommandList->SetComputeDescriptorTable(baseIdx + 3, m_outTables[0]);
+		if (!isTiled) pCommandList->SetComputeDescriptorTable(baseIdx + 4, m_rateTable);
 
 		// Set pipeline state
-		pCommandList->SetPipelineState(m_pipelines[PIX_RASTER]);
+		pCommandList->SetPipelineState(m_pipelines[pixRaster]);
 
-		// Dispatch indirect
-		pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_tilePrimCount.get(), 0, m_tilePrimCount.get());
+		// Dispatch, one group per tile for the tile-ordered raster
+		if (isTiled) pCommandList->Dispatch(cbViewport.NumTileX, cbViewport.NumTileY, 1);
+		else pCommandList->ExecuteIndirect(m_commandLayout.get(), 1, m_tilePrimCount.get(), 0, m_tilePrimCount.get());
 	}
 }
+
+bool SoftGraphicsPipeline::buildTileLists(CommandList* pCommandList, const CBViewPort& cbViewport)
+{
+	const auto numTiles = cbViewport.NumTileX * cbViewport.NumTileY;
+	if (numTiles > m_maxTileCount) XUSG_N_RETURN(createTileListBuffers(pCommandList->GetDevice(), numTiles), false);
+
+	// Set resource barriers, the tile primitives are still being written by the tile raster
+	const auto pTileLists = m_transients[TRANSIENT_TILE_LISTS];
+	{
+		const BufferAccess accesses[] =
+		{
+			{ m_tileListRanges.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE },
+			{ m_tilePrimCount.get(), ResourceState::UNORDERED_ACCESS, ACCESS_READ },
+			{ m_tilePrimitives.get(), ResourceState::UNORDERED_ACCESS, ACCESS_READ }
+		};
+		transition(pCommandList, static_cast<uint32_t>(size(accesses)), accesses);
+	}
+
+	// Clear the per-tile counts
+	const uint32_t clearValues[4] = {};
+	pCommandList->ClearUnorderedAccessViewUint(m_uavTables[UAV_TABLE_TL], m_tileListRanges->GetUAV(),
+		m_tileListRanges.get(), clearValues);
+
+	// Set descriptor tables
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[TILE_COUNT]);
+	pCommandList->SetCompute32BitConstants(0, XUSG_UINT32_SIZE_OF(cbViewport), &cbViewport);
+	pCommandList->SetComputeDescriptorTable(1, m_uavTables[UAV_TABLE_TL]);
+
+	// Count the primitives of each tile, after the clear
+	const BufferAccess countAccess = { m_tileListRanges.get(), ResourceState::UNORDERED_ACCESS, ACCESS_APPEND };
+	transition(pCommandList, 1, &countAccess);
+	pCommandList->SetPipelineState(m_pipelines[TILE_COUNT]);
+	pCommandList->Dispatch(TILE_LIST_GROUP_COUNT, 1, 1);
+
+	// Prefix sum the counts to the list offsets
+	const BufferAccess scanAccess = { m_tileListRanges.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE };
+	transition(pCommandList, 1, &scanAccess);
+	pCommandList->SetPipelineState(m_pipelines[TILE_SCAN]);
+	pCommandList->Dispatch(1, 1, 1);
+
+	// Scatter the primitive IDs into the lists
+	const BufferAccess scatterAccesses[] =
+	{
+		{ m_tileListRanges.get(), ResourceState::UNORDERED_ACCESS, ACCESS_WRITE },
+		{ pTileLists, ResourceState::UNORDERED_ACCESS, ACCESS_WRITE }
+	};
+	transition(pCommandList, static_cast<uint32_t>(size(scatterAccesses)), scatterAccesses);
+	pCommandList->SetPipelineState(m_pipelines[TILE_SCATTER]);
+	pCommandList->Dispatch(TILE_LIST_GROUP_COUNT, 1, 1);
+
+	// Sort each list into submission order
+	transition(pCommandList, static_cast<uint32_t>(size(scatterAccesses)), scatterAccesses);
+	pCommandList->SetPipelineState(m_pipelines[TILE_SORT]);
+	pCommandList->Dispatch(cbViewport.NumTileX, cbViewport.NumTileY, 1);
+
+	return true;
+}
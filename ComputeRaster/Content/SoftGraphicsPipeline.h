@@ -14,7 +14,64 @@ public:
 	{
 		XUSG::Texture2D::uptr PixelZ;
 		XUSG::Texture2D::uptr TileZ;
-		XUSG::Texture2D::uptr BinZ;
+		XUSG::Texture2D::uptr BinZ[MAX_BIN_LEVELS];	// From the finest bin level to the coarsest
+		XUSG::Texture2D::uptr Pyramid;	// Max depth of 2^(i+1) x 2^(i+1) pixels at mip i, up to the edges
+	};
+
+	struct ShaderDefine
+	{
+		std::string Name;
+		std::string Definition;
+	};
+
+	enum RasterMode : uint8_t
+	{
+		RASTER_UNORDERED,	// One group per tile-primitive pair, resolved by atomics
+		RASTER_TILE_ORDERED	// One group per tile, primitives in submission order
+	};
+
+	enum BlendMode : uint8_t
+	{
+		BLEND_OPAQUE,
+		BLEND_ALPHA,
+		BLEND_ADDITIVE,
+		BLEND_PREMULTIPLIED
+	};
+
+	// Feature switches of the shader permutations
+	enum FeatureFlag : uint8_t
+	{
+		FEATURE_HI_Z = (1 << 0),			// Depth tests of the bins and the tiles against the HiZ
+		FEATURE_RE_HI_Z = (1 << 1),			// Repeats the HiZ tests in the refine and the pixel rasters
+		FEATURE_MUTEX = (1 << 2),			// Depth-tested writes in the critical sections, watertight but slower
+		FEATURE_MUTEX_DEPTH_ORDERED = (1 << 3),	// Also the depth-ordered tests in the critical sections
+		FEATURE_VRS = (1 << 4)				// Coarse shading of the unordered pixel raster by the shading rates
+	};
+
+	// Coarse pixel sizes, of which the pixel shader is called once per coarse pixel
+	enum ShadingRate : uint8_t
+	{
+		SHADING_RATE_1X1,
+		SHADING_RATE_2X2,
+		SHADING_RATE_4X4
+	};
+
+	struct DrawArgs
+	{
+		uint32_t NumVertices;	// Indices of the indexed draws
+		uint32_t NumInstances;
+		uint32_t StartVertex;	// Start index of the indexed draws
+		int32_t BaseVertex;		// Added to the indices
+		uint32_t BaseInstance;	// Of the per-instance data, g_baseInstance in the vertex shader
+	};
+
+	struct DrawObject
+	{
+		DrawArgs Args;
+		DirectX::XMFLOAT3 BoundMin;	// Bounds of all the instances in the space of the culling matrix
+		DirectX::XMFLOAT3 BoundMax;
+		DirectX::XMFLOAT3 ConeAxis;	// Normal cone of the meshlets, where the cutoff 1 disables the back-face test
+		float ConeCutoff;
 	};
 
 	SoftGraphicsPipeline();
@@ -22,23 +79,51 @@ public:
 
 	bool Init(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool CreateVertexShaderLayout(XUSG::Util::PipelineLayout* pPipelineLayout,
-		uint32_t slotCount = 0, int32_t srvBindingMax = -1, int32_t uavBindingMax = -1);
+		uint32_t slotCount = 0, int32_t srvBindingMax = -1, int32_t uavBindingMax = -1,
+		int32_t cbvBindingMax = -1);
 	bool CreatePixelShaderLayout(XUSG::Util::PipelineLayout* pPipelineLayout,
 		bool hasDepth, uint32_t numRTs, uint32_t slotCount = 0, int32_t cbvBindingMax = -1,
 		int32_t srvBindingMax = -1, int32_t uavBindingMax = -1);
+	bool Compile();	// Creates the pipelines on the worker threads after the shader layouts, warm-started from the disk cache
 	void SetDecriptorHeaps(XUSG::CommandList* pCommandList);
 	void SetAttribute(uint32_t i, uint32_t stride, XUSG::Format format, const wchar_t* name = L"Attribute");
 	void SetVertexBuffer(const XUSG::Descriptor& vertexBufferView);
 	void SetIndexBuffer(const XUSG::Descriptor& indexBufferView);
-	void SetRenderTargets(uint32_t numRTs, XUSG::Texture2D* pColorTarget, DepthBuffer* pDepth);
+	void SetRenderTargets(uint32_t numRTs, XUSG::Texture2D* pColorTarget, DepthBuffer* pDepth);	// No targets for the depth-only pipeline
 	void SetViewport(const XUSG::Viewport& viewport);
+	void SetScissorRect(const XUSG::RectRange& rect);	// Bounds the binning and the raster, clipped by the viewport
+	void SetDirtyRects(uint32_t numRects, const XUSG::RectRange* pRects);	// Limits the clears and the raster to the merged rectangles, none for the full target
+	void SetViews(uint32_t numViews, uint32_t numColumns);	// Broadcasts the primitives to a grid of viewport-sized views
+	void SetRasterMode(RasterMode mode);
+	void SetBlendMode(BlendMode mode);	// Applied to target 0, blending implies the tile-ordered raster
+	void SetShadingRate(ShadingRate rate);	// Of the draws, the larger of it and the rate image applies, with FEATURE_VRS
+	void SetShadingRateImage(XUSG::Texture2D* pRateImage);	// R8_UINT of a ShadingRate per tile, nullptr for none
+	void SetTileSizes(uint8_t tileSizeLog, uint8_t tileToBinLog);	// Call before CreateDepthBuffer()
+	void SetBinLevels(uint8_t numBinLevels);	// Bin levels above the tiles, each is 2^tileToBinLog times coarser
+	void SetOcclusionCulling(bool enable);	// Two-pass culling against the depth pyramid, on the unordered raster only
+	void SetDepthState(XUSG::ComparisonFunc func, bool depthWrite = true);	// GREATER(_EQUAL) for reverse-Z, the others keep the last direction
+	void SetShaderDefines(uint32_t numDefines, const ShaderDefine* pDefines);	// Pixel shader macros for the permutations
+	void SetFeatures(uint8_t features);	// FeatureFlags, the permutations other than DefaultFeatures are compiled or loaded from the library
+	void SetFrameIndex(uint8_t frameIndex);	// Call once per frame before drawing, for the frame-based feedbacks
 	void VSSetDescriptorTable(uint32_t i, const XUSG::DescriptorTable& descriptorTable);
+	// Of the data behind the VS descriptor tables, the same inputs reuse the vertex outputs, 0 disables.
+	// Only the outputs of the last draw are kept, so set it for a single draw per frame, e.g., with its
+	// Z-prepass, and 0 for the other draws
+	void VSSetDataHash(uint64_t hash);
 	void PSSetDescriptorTable(uint32_t i, const XUSG::DescriptorTable& descriptorTable);
 	void ClearFloat(const XUSG::Texture2D& target, const float clearValues[4]);
 	void ClearUint(const XUSG::Texture2D& target, const uint32_t clearValues[4]);
 	void ClearDepth(const float clearValue);
-	void Draw(XUSG::CommandList* pCommandList, uint32_t numVertices);
-	void DrawIndexed(XUSG::CommandList* pCommandList, uint32_t numIndices);
+	// The draws fail beyond MAX_DRAW_RECORDS draw records per frame
+	bool Draw(XUSG::CommandList* pCommandList, uint32_t numVertices);
+	bool DrawIndexed(XUSG::CommandList* pCommandList, uint32_t numIndices);
+	bool DrawInstanced(XUSG::CommandList* pCommandList, uint32_t numVertices, uint32_t numInstances);
+	bool DrawIndexedInstanced(XUSG::CommandList* pCommandList, uint32_t numIndices, uint32_t numInstances);	// g_instanceId in the vertex shader
+	bool DrawBatch(XUSG::CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws);
+	bool DrawIndexedBatch(XUSG::CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws);	// g_drawId in the vertex and pixel shaders
+	bool DrawIndexedIndirect(XUSG::CommandList* pCommandList, const XUSG::StructuredBuffer* pObjects, uint32_t numObjects,
+		uint32_t maxVertices, DirectX::CXMMATRIX viewProj);	// Culls the DrawObjects on the GPU, maxVertices bounds all their vertices
+	void BuildDepthPyramid(XUSG::CommandList* pCommandList);	// Max-depth mips of PixelZ, e.g., after the last draw of a frame
 
 	bool CreateDepthBuffer(const XUSG::Device* pDevice, DepthBuffer &depth, uint32_t width,
 		uint32_t height, XUSG::Format format, const wchar_t* name = L"Depth");
@@ -49,17 +134,42 @@ public:
 		std::vector<XUSG::Resource::uptr>& uploaders, const void* pData, uint32_t numIdx,
 		XUSG::Format format, const wchar_t* name = L"IndexBuffer");
 	XUSG::DescriptorTableLib* GetDescriptorTableLib() const;
+	uint8_t GetTileSizeLog() const;
+	uint8_t GetTileToBinLog() const;
+	uint8_t GetBinLevels() const;
+	uint8_t GetFeatures() const;
+
+	// Tests a screen rectangle in pixels against the depth pyramid read back FrameCount frames ago,
+	// where zMin is the nearest depth, i.e., the greatest one with reverse-Z
+	bool IsOccluded(float left, float top, float right, float bottom, float zMin) const;
+
+	static uint64_t Hash(const void* pData, size_t size, uint64_t seed = 14695981039346656037ull);
 
 	static const uint8_t FrameCount = FRAME_COUNT;
+	static const uint8_t DefaultFeatures = FEATURE_HI_Z | FEATURE_MUTEX;	// Of the precompiled shaders
+	static const uint8_t MaxDirtyRects = 16;
 
 protected:
+	static const uint8_t MaxColorTargets = 8;	// D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT
+	static const uint8_t MaxCachedTables = 64;	// The least recently used ones are evicted beyond
+
 	enum StageIndex : uint8_t
 	{
 		VERTEX_PROCESS,
 		VERTEX_INDEXED,
+		VERTEX_DEPTH,
+		VERTEX_INDEXED_DEPTH,
 		BIN_RASTER,
 		TILE_RASTER,
 		PIX_RASTER,
+		PIX_RASTER_DEPTH,
+		TILE_COUNT,
+		TILE_SCAN,
+		TILE_SCATTER,
+		TILE_SORT,
+		PIX_RASTER_TILED,
+		DEPTH_PYRAMID,
+		DRAW_CULL,
 
 		NUM_STAGE
 	};
@@ -68,15 +178,52 @@ protected:
 	{
 		SRV_TABLE_VS,
 		SRV_TABLE_TR,
-		SRV_TABLE_PS,
+		SRV_TABLE_PS = SRV_TABLE_TR + MAX_BIN_LEVELS,
+		SRV_TABLE_PS_TILED,
+		SRV_TABLE_PYRAMID,
+		SRV_TABLE_CULL,
 
 		NUM_SRV_TABLE
 	};
 
+	// Transient buffers of the draws, which share the physical buffers of the same strides
+	// if their live phases never overlap within any raster mode
+	enum TransientBuffer : uint8_t
+	{
+		TRANSIENT_BIN_PRIMS,
+		TRANSIENT_TILE_LISTS = TRANSIENT_BIN_PRIMS + MAX_BIN_LEVELS,
+		TRANSIENT_REJECTED_PRIMS,
+		TRANSIENT_PYRAMID_MIP,
+
+		NUM_TRANSIENT
+	};
+
+	// Phases of a draw, over which the transient buffers are live
+	enum DrawPhase : uint8_t
+	{
+		PHASE_BIN = (1 << 0),
+		PHASE_REFINE = (1 << 1),
+		PHASE_TILE_LIST = (1 << 2),
+		PHASE_PIXEL = (1 << 3),
+		PHASE_PYRAMID = (1 << 4)
+	};
+
+	// Accesses of the stages to the buffers, where the concurrent reads, or the concurrent
+	// atomic appends, need no UAV barriers in between
+	enum AccessType : uint8_t
+	{
+		ACCESS_READ,
+		ACCESS_WRITE,
+		ACCESS_APPEND
+	};
+
 	enum UAVTable : uint8_t
 	{
 		UAV_TABLE_VS,
 		UAV_TABLE_RS,
+		UAV_TABLE_TR,
+		UAV_TABLE_TL = UAV_TABLE_TR + MAX_BIN_LEVELS,
+		UAV_TABLE_CULL,
 
 		NUM_UAV_TABLE
 	};
@@ -91,6 +238,43 @@ protected:
 		uint32_t NumTileY;
 		uint32_t NumBinX;
 		uint32_t NumBinY;
+		uint32_t Blend;
+		float BinThreshold;
+		uint32_t NumBinLevels;
+		uint32_t RefineSizeLog;
+		uint32_t OcclusionPass;
+		uint32_t DepthFunc;
+		uint32_t DepthFlip;
+		uint32_t DepthWrite;
+		uint32_t ScissorLeft;
+		uint32_t ScissorTop;
+		uint32_t ScissorRight;
+		uint32_t ScissorBottom;
+		uint32_t NumViewPrims;
+		uint32_t ViewColumns;
+		uint32_t NumDrawPrims;
+		uint32_t ShadingRateLog;
+		uint32_t HasRateImage;
+	};
+
+	struct CBCull
+	{
+		DirectX::XMFLOAT4X4 ViewProj;
+		DirectX::XMFLOAT4 EyePt;
+		uint32_t NumObjects;
+		uint32_t NumViews;
+		uint32_t CullPass;
+	};
+
+	struct DrawRecord
+	{
+		uint32_t NumVertices;
+		uint32_t NumInstances;
+		uint32_t StartVertex;
+		int32_t BaseVertex;
+		uint32_t BaseInstance;
+		uint32_t VertexOffset;
+		uint32_t DrawId;
 	};
 
 	struct AttributeInfo
@@ -100,6 +284,45 @@ protected:
 		std::wstring Name;
 	};
 
+	struct PyramidReadback
+	{
+		uint8_t Mip;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t DepthFlip;	// Of the depth function the keys are built under
+	};
+
+	struct TableCacheEntry
+	{
+		XUSG::Descriptor Descriptors[3];	// The unused ones are null
+		XUSG::DescriptorTable Table;
+		uint64_t LastUse;
+	};
+
+	struct TransientInfo
+	{
+		uint32_t Stride;
+		uint8_t Phases;			// Live phases
+		uint8_t RasterModes;	// Bits of the raster modes using the buffer
+		const wchar_t* Name;
+	};
+
+	struct BufferAccess
+	{
+		XUSG::Resource* pBuffer;
+		XUSG::ResourceState State;
+		AccessType Type;
+	};
+
+	struct StageInfo
+	{
+		const wchar_t* FileName;
+		const wchar_t* Name;
+		uint8_t Features;	// FeatureFlags of the shader
+		bool IsTileSized;	// Depends on the tile sizes
+		bool HasAttributes;	// Depends on the shader defines of the attributes and the targets
+	};
+
 	struct ClearInfo
 	{
 		bool IsUint;
@@ -111,32 +334,79 @@ protected:
 		};
 	};
 
-	bool createPipelines();
+	static const TransientInfo TransientInfos[NUM_TRANSIENT];
+	static const StageInfo StageInfos[NUM_STAGE];
+
+	bool createPipelineLayouts();
+	bool createPipeline(StageIndex index, XUSG::Compute::PipelineLib* pPipelineLib);	// Thread-safe for the different stages
+	bool loadShader(StageIndex index, XUSG::com_ptr<ID3DBlob>& shader);
+	float selectBinThreshold(const uint32_t* pAreaHistogram) const;
 	bool createResetBuffer(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createCommandLayout(const XUSG::Device* pDevice);
+	bool createDrawCommandLayouts(const XUSG::Device* pDevice);
 	bool createDescriptorTables();
+	bool createTileListBuffers(const XUSG::Device* pDevice, uint32_t numTiles);
+	bool createTransient(const XUSG::Device* pDevice, TransientBuffer transient, size_t numElements);
+
+	XUSG::DescriptorTable getCachedTable(uint32_t numDescriptors, const XUSG::Descriptor* pDescriptors);
 
-	void draw(XUSG::CommandList* pCommandList, uint32_t num, StageIndex vs);
-	void rasterizer(XUSG::CommandList* pCommandList, uint32_t numTriangles);
+	bool isDepthOnlyPipeline() const;
+	bool isTiledPipeline() const;
+	bool isTwoPassCulling(const CBViewPort& cbViewport) const;
+	bool computeViewport(CBViewPort& cbViewport, uint32_t numTriangles, const XUSG::RectRange& scissorRect) const;
 
-	XUSG::ShaderLib::uptr				m_shaderLib;
-	XUSG::Compute::PipelineLib::uptr	m_computePipelineLib;
+	uint64_t hashVertexInputs(uint32_t num, uint32_t numDraws, uint32_t baseRecord, StageIndex vs) const;
+	uint64_t hashStaticDraw(uint32_t num, uint32_t numDraws, uint32_t baseRecord, StageIndex vs) const;	// 0 if not reusable
+
+	void clearHiZ(XUSG::CommandList* pCommandList, const uint32_t* pClearValue);
+	void assignTransients();
+	void decayBuffers();
+	void transition(XUSG::CommandList* pCommandList, uint32_t numAccesses,
+		const BufferAccess* pAccesses, uint32_t numBarriers = 0);	// Batched after the first numBarriers of m_barriers
+
+	bool draw(XUSG::CommandList* pCommandList, uint32_t numDraws, const DrawArgs* pDraws, StageIndex vs);
+	bool drawRecords(XUSG::CommandList* pCommandList, uint32_t num, uint32_t numDraws,
+		uint32_t baseRecord, StageIndex vs, const CBCull* pCbCull = nullptr);
+	void cullDraws(XUSG::CommandList* pCommandList, const CBViewPort& cbViewport, const CBCull& cbCull);
+	void processVertices(XUSG::CommandList* pCommandList, uint32_t num, uint32_t numDraws,
+		uint32_t baseRecord, StageIndex vs, bool isIndirect);
+	bool rasterizer(XUSG::CommandList* pCommandList, const CBViewPort& cbViewport,
+		bool isIndirect, bool isSinglePass = false);	// The single pass keeps all the tile primitives
+	bool rasterPass(XUSG::CommandList* pCommandList, const CBViewPort& cbViewport,
+		uint32_t numTriangles, bool isTiled, bool isIndirect);
+	void pixelPass(XUSG::CommandList* pCommandList, const CBViewPort& cbViewport, bool isTiled, bool isReadback);
+	bool buildTileLists(XUSG::CommandList* pCommandList, const CBViewPort& cbViewport);
+
+	std::vector<XUSG::Compute::PipelineLib::uptr> m_computePipelineLibs;	// One per worker
 	XUSG::PipelineLayoutLib::uptr		m_pipelineLayoutLib;
 	XUSG::DescriptorTableLib::uptr		m_descriptorTableLib;
 
 	XUSG::PipelineLayout		m_pipelineLayouts[NUM_STAGE];
+	std::string					m_layoutKeys[NUM_STAGE];	// Keys of the pipeline cache with the shader hashes
 	XUSG::Pipeline				m_pipelines[NUM_STAGE];
 	XUSG::CommandLayout::uptr	m_commandLayout;
+	XUSG::CommandLayout::uptr	m_vsCommandLayout;
+	XUSG::CommandLayout::uptr	m_binCommandLayout;
 
-	std::vector<ClearInfo> m_clears;
 	std::vector<XUSG::DescriptorTable> m_extVsTables;
 	std::vector<XUSG::DescriptorTable> m_extPsTables;
-	std::vector<XUSG::DescriptorTable> m_outTables;
+	std::vector<ShaderDefine> m_shaderDefines;
+	std::unordered_map<uint64_t, TableCacheEntry> m_tableCache;	// Keyed by the hash of the descriptors
+	std::mutex m_permutationMutex;	// Guards the index of the permutation library
+	std::vector<XUSG::DescriptorTable> m_pyramidTables;
 
 	XUSG::DescriptorTable	m_cbvTable;
 	XUSG::DescriptorTable	m_srvTables[NUM_SRV_TABLE];
 	XUSG::DescriptorTable	m_uavTables[NUM_UAV_TABLE];
 	XUSG::DescriptorTable	m_samplerTable;
+	XUSG::DescriptorTable	m_outTables[MaxColorTargets + 2 + MAX_BIN_LEVELS];
+
+	// Fixed capacities, so that recording the draws allocates nothing in the steady state
+	ClearInfo				m_clears[MaxColorTargets];
+	XUSG::RectRange			m_dirtyRects[MaxDirtyRects];
+	std::vector<XUSG::ResourceBarrier> m_barriers;	// Scratch of the stage transitions, grown with the attributes
+	std::vector<BufferAccess> m_accesses;			// Declared accesses of a stage, as above
+	std::vector<BufferAccess> m_uavAccesses;		// Unordered accesses since the last barriers of the buffers
 
 	XUSG::ConstantBuffer::uptr	m_cbMatrices;
 	XUSG::ConstantBuffer::uptr	m_cbPerFrame;
@@ -147,20 +417,82 @@ protected:
 	XUSG::Descriptor	m_indexBufferView;
 	XUSG::Texture2D*	m_pColorTarget;
 	DepthBuffer*		m_pDepth;
+	XUSG::Texture2D*	m_pRateImage;
+	XUSG::Texture2D::uptr m_defaultRateImage;	// Bound without a rate image
+	XUSG::DescriptorTable m_rateTable;
 
 	std::vector<AttributeInfo> m_attribInfo;
 	std::vector<XUSG::TypedBuffer::uptr> m_vertexAttribs;
 	XUSG::StructuredBuffer::uptr	m_vertexCompletions;
 	XUSG::StructuredBuffer::uptr	m_vertexPos;
+	XUSG::StructuredBuffer::uptr	m_primDrawIds;
+	XUSG::StructuredBuffer::uptr	m_drawRecords;
+	XUSG::StructuredBuffer::uptr	m_culledRecords;
+	XUSG::StructuredBuffer::uptr	m_drawArgs;
+	XUSG::StructuredBuffer::uptr	m_rejectedObjects;
 	XUSG::StructuredBuffer::uptr	m_tilePrimCountReset;
-	XUSG::StructuredBuffer::uptr	m_binPrimCount;
-	XUSG::StructuredBuffer::uptr	m_binPrimitives;
+	XUSG::StructuredBuffer::uptr	m_binPrimCounts[MAX_BIN_LEVELS];
 	XUSG::StructuredBuffer::uptr	m_tilePrimCount;
 	XUSG::StructuredBuffer::uptr	m_tilePrimitives;
+	XUSG::StructuredBuffer::uptr	m_tileListRanges;
+	XUSG::StructuredBuffer::uptr	m_areaHistogram;
+	XUSG::StructuredBuffer::uptr	m_areaHistogramReset;
+	XUSG::Buffer::uptr				m_areaHistogramReadback;
+	XUSG::StructuredBuffer::uptr	m_rejectedCount;
+	XUSG::StructuredBuffer::uptr	m_rejectedArgs;
+	XUSG::StructuredBuffer::uptr	m_physicalTransients[NUM_TRANSIENT];
+	std::vector<XUSG::Resource::uptr> m_retiredBuffers[FrameCount];	// Replaced buffers, kept until the frames in flight complete
+	XUSG::StructuredBuffer*			m_transients[NUM_TRANSIENT];
+	size_t							m_transientSizes[NUM_TRANSIENT];	// Capacities of the physical buffers
+	uint8_t							m_transientSlots[NUM_TRANSIENT];	// Physical buffer of each transient
+	XUSG::Buffer::uptr				m_pyramidReadback;
+
+	PyramidReadback			m_pyramidReadbacks[FrameCount];
+	PyramidReadback			m_pyramidCacheInfo;
+	std::vector<uint32_t>	m_pyramidCache;
+
+	DrawRecord*				m_pDrawRecords;
 
 	XUSG::Viewport			m_viewport;
+	XUSG::RectRange			m_scissorRect;
 
 	uint32_t				m_maxVertexCount;
+	uint32_t				m_numDrawRecords;
+	uint32_t				m_numViews;
+	uint32_t				m_viewColumns;
 	uint32_t				m_numColorTargets;
+	uint32_t				m_numOutTables;
+	uint32_t				m_numClears;
+	uint32_t				m_numDirtyRects;
 	uint32_t				m_clearDepth;
+	uint32_t				m_depthFlip;
+	uint32_t				m_maxTileCount;
+	uint64_t				m_vsDataHash;
+	uint64_t				m_vertexHash;	// Inputs of the current vertex outputs, 0 if unknown
+	uint64_t				m_frameVertexHash;	// Of the only draw of the frame reusing the vertex outputs, 0 if none
+	uint64_t				m_drawHash;		// Of the only draw of the frame into the cleared depth, 0 if none
+	uint64_t				m_lastDrawHash;	// As above, of the previous frame
+	uint64_t				m_tableCacheClock;	// Stamps the last uses of the cached tables
+
+	uint8_t					m_tileSizeLog;
+	uint8_t					m_tileToBinLog;
+	uint8_t					m_numBinLevels;
+	uint8_t					m_features;
+	bool					m_isPipelineDirty;
+	bool					m_isCompiled;
+	bool					m_isCompileFailed;	// Not retried by the draws until the layouts, tile sizes, or features change
+	bool					m_hasVertexAttribs;
+	bool					m_isDrawResident;		// All the tile primitives of the draw are resident
+	bool					m_isLastDrawResident;
+	bool					m_isTableDirty;
+	bool					m_isHistogramDirty;
+	uint8_t					m_frameIndex;
+	float					m_binThreshold;
+	bool					m_occlusionCulling;
+	bool					m_depthWrite;
+
+	RasterMode				m_rasterMode;
+	BlendMode				m_blendMode;
+	ShadingRate				m_shadingRate;
+	XUSG::ComparisonFunc	m_depthFunc;
 };
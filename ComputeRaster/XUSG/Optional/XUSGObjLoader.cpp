@@ -69,6 +69,65 @@ const ObjLoader::AABB& ObjLoader::GetAABB() const
 	return m_aabb;
 }
 
+void ObjLoader::BuildMeshlets(uint32_t maxVertices, uint32_t maxPrims)
+{
+	if (maxVertices < 3) maxVertices = 3;
+	if (maxPrims < 1) maxPrims = 1;
+
+	vector<uint32_t> vertices;
+	vertices.reserve(maxVertices);
+	m_meshlets.clear();
+
+	Meshlet meshlet = {};
+	const auto numTri = static_cast<uint32_t>(m_indices.size()) / 3;
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		// Unique vertices of the triangle, which are not in the meshlet yet
+		uint32_t newVerts[3];
+		auto numNewVerts = 0u;
+		for (auto j = 0u; j < 3; ++j)
+		{
+			const auto vi = m_indices[i * 3 + j];
+			if (find(vertices.cbegin(), vertices.cend(), vi) == vertices.cend() &&
+				find(newVerts, newVerts + numNewVerts, vi) == newVerts + numNewVerts)
+				newVerts[numNewVerts++] = vi;
+		}
+
+		// Close the meshlet if the triangle exceeds either limit
+		if (vertices.size() + numNewVerts > maxVertices || meshlet.NumIndices / 3 >= maxPrims)
+		{
+			computeMeshletBounds(meshlet);
+			m_meshlets.push_back(meshlet);
+			meshlet.StartIndex = i * 3;
+			meshlet.NumIndices = 0;
+			vertices.clear();
+		}
+
+		for (auto j = 0u; j < 3; ++j)
+		{
+			const auto vi = m_indices[i * 3 + j];
+			if (find(vertices.cbegin(), vertices.cend(), vi) == vertices.cend()) vertices.push_back(vi);
+		}
+		meshlet.NumIndices += 3;
+	}
+
+	if (meshlet.NumIndices > 0)
+	{
+		computeMeshletBounds(meshlet);
+		m_meshlets.push_back(meshlet);
+	}
+}
+
+const uint32_t ObjLoader::GetNumMeshlets() const
+{
+	return static_cast<uint32_t>(m_meshlets.size());
+}
+
+const ObjLoader::Meshlet* ObjLoader::GetMeshlets() const
+{
+	return m_meshlets.data();
+}
+
 void ObjLoader::importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm)
 {
 	auto v = 0u;
@@ -415,6 +474,66 @@ void ObjLoader::computeAABB()
 	m_aabb.Max = float3(xMax, yMax, zMax);
 }
 
+void ObjLoader::computeMeshletBounds(Meshlet& meshlet)
+{
+	// Bounding box
+	auto& aabb = meshlet.Bounds;
+	aabb.Min = aabb.Max = getPosition(m_indices[meshlet.StartIndex]);
+	for (auto i = 1u; i < meshlet.NumIndices; ++i)
+	{
+		const auto& p = getPosition(m_indices[meshlet.StartIndex + i]);
+		if (p.x < aabb.Min.x) aabb.Min.x = p.x;
+		if (p.x > aabb.Max.x) aabb.Max.x = p.x;
+		if (p.y < aabb.Min.y) aabb.Min.y = p.y;
+		if (p.y > aabb.Max.y) aabb.Max.y = p.y;
+		if (p.z < aabb.Min.z) aabb.Min.z = p.z;
+		if (p.z > aabb.Max.z) aabb.Max.z = p.z;
+	}
+
+	// Bounding sphere centered at the box
+	auto& c = meshlet.Center;
+	c = float3((aabb.Min.x + aabb.Max.x) * 0.5f, (aabb.Min.y + aabb.Max.y) * 0.5f, (aabb.Min.z + aabb.Max.z) * 0.5f);
+	auto r2 = 0.0f;
+	for (auto i = 0u; i < meshlet.NumIndices; ++i)
+	{
+		const auto& p = getPosition(m_indices[meshlet.StartIndex + i]);
+		const auto d2 = (p.x - c.x) * (p.x - c.x) + (p.y - c.y) * (p.y - c.y) + (p.z - c.z) * (p.z - c.z);
+		if (d2 > r2) r2 = d2;
+	}
+	meshlet.Radius = sqrt(r2);
+
+	// Normal cone, of which the axis is the average of the face normals
+	const auto startTri = meshlet.StartIndex / 3;
+	const auto numTri = meshlet.NumIndices / 3;
+	auto& axis = meshlet.ConeAxis;
+	axis = float3(0.0f, 0.0f, 0.0f);
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto n = getFaceNormal(startTri + i);
+		axis.x += n.x;
+		axis.y += n.y;
+		axis.z += n.z;
+	}
+
+	const auto l = sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+	meshlet.ConeCutoff = 1.0f;
+	if (l <= 0.0f) return;
+	axis.x /= l;
+	axis.y /= l;
+	axis.z /= l;
+
+	auto minDot = 1.0f;
+	for (auto i = 0u; i < numTri; ++i)
+	{
+		const auto n = getFaceNormal(startTri + i);
+		const auto d = n.x * axis.x + n.y * axis.y + n.z * axis.z;
+		if (d < minDot) minDot = d;
+	}
+
+	// The cone spreading about a hemisphere always has front faces
+	if (minDot > 0.1f) meshlet.ConeCutoff = sqrt(1.0f - minDot * minDot);
+}
+
 void* ObjLoader::getVertex(uint32_t i)
 {
 	return &m_vertices[GetVertexStride() * i];
@@ -429,3 +548,23 @@ ObjLoader::float3& ObjLoader::getNormal(uint32_t i)
 {
 	return reinterpret_cast<float3*>(getVertex(i))[1];
 }
+
+ObjLoader::float3 ObjLoader::getFaceNormal(uint32_t i)
+{
+	// Same winding as the recomputed vertex normals, and zero for the degenerate triangles
+	const auto& p0 = getPosition(m_indices[i * 3]);
+	const auto& p1 = getPosition(m_indices[i * 3 + 1]);
+	const auto& p2 = getPosition(m_indices[i * 3 + 2]);
+	const float3 e1(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+	const float3 e2(p2.x - p1.x, p2.y - p1.y, p2.z - p1.z);
+	float3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+	const auto l = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+	if (l > 0.0f)
+	{
+		n.x /= l;
+		n.y /= l;
+		n.z /= l;
+	}
+
+	return n;
+}
@@ -28,6 +28,17 @@ namespace XUSG
 			float3 Max;
 		};
 
+		struct Meshlet
+		{
+			uint32_t StartIndex;
+			uint32_t NumIndices;	// 3 per triangle
+			AABB Bounds;
+			float3 Center;		// Bounding sphere
+			float Radius;
+			float3 ConeAxis;	// Normal cone, where the cutoff 1 never rejects the meshlet as back-facing
+			float ConeCutoff;
+		};
+
 		ObjLoader();
 		virtual ~ObjLoader();
 
@@ -42,6 +53,11 @@ namespace XUSG
 
 		const AABB& GetAABB() const;
 
+		// Partitions the triangles in the index order, so each meshlet is a range of the indices
+		void BuildMeshlets(uint32_t maxVertices = 64, uint32_t maxPrims = 124);
+		const uint32_t GetNumMeshlets() const;
+		const Meshlet* GetMeshlets() const;
+
 	protected:
 		void importGeometryFirstPass(FILE* pFile, uint32_t& numTexc, uint32_t& numNorm);
 		void importGeometrySecondPass(FILE* pFile, uint32_t numTexc, uint32_t numNorm, bool forDX, bool swapYZ);
@@ -50,13 +66,16 @@ namespace XUSG
 		void computePerVertexNormals(const std::vector<float3>& normals, const std::vector<uint32_t>& nIndices);
 		void recomputeNormals();
 		void computeAABB();
+		void computeMeshletBounds(Meshlet& meshlet);
 
 		void* getVertex(uint32_t i);
 		float3& getPosition(uint32_t i);
 		float3& getNormal(uint32_t i);
+		float3 getFaceNormal(uint32_t i);
 
 		std::vector<uint8_t>	m_vertices;
 		std::vector<uint32_t>	m_indices;
+		std::vector<Meshlet>	m_meshlets;
 
 		uint32_t	m_stride;
 
@@ -32,6 +32,7 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
 
 #if _HAS_CXX17
 #include <winrt/base.h>
@@ -42,6 +43,8 @@
 #include <unordered_map>
 #endif
 #include <functional>
+#include <thread>
+#include <mutex>
 #include <wrl.h>
 #include <shellapi.h>
 